@@ -1,13 +1,49 @@
+#include <algorithm>
 #include <array>
 #include <iostream>
 #include <string>
 #include <thread>
 #include <atomic>
 #include <chrono>
+#include <cctype>
+#include <cerrno>
 #include <cmath>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 #include <vector>
 
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <xmmintrin.h>
+#endif
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 #define DEBUG_MODE 1
+#ifndef TT_PREFETCH
+#define TT_PREFETCH 0 // Prefetch the TT bucket of children that will probe it, off until it measures faster
+#endif
 
 using std::cout;
 
@@ -33,11 +69,556 @@ enum class GameState {
     Stalemate
 };
 
+inline int sideIndex(uint8_t color) { return (color == Piece::White) ? 0 : 1; }
+
+// A single move, squares are indexed row * 8 + col (row 0 is rank 8)
+struct Move {
+    uint8_t from = 0;
+    uint8_t to = 0;
+    uint8_t captured = Piece::None;
+};
+
+// --- Memory Accounting ---
+// Each subsystem registers a reporter for its allocated and resident bytes.
+// Entries with the same name (e.g. one per search thread) are summed in the report.
+
+struct MemoryUsage {
+    size_t allocated = 0;
+    size_t resident = 0;
+};
+
+class MemoryRegistry {
+public:
+    using Reporter = std::function<MemoryUsage()>;
+
+    int add(const std::string& name, Reporter reporter) {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.push_back({ nextHandle, name, std::move(reporter) });
+        return nextHandle++;
+    }
+
+    void remove(int handle) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (entries[i].handle == handle) { entries.erase(entries.begin() + i); return; }
+        }
+    }
+
+    void report() const {
+        std::map<std::string, MemoryUsage> totals;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const Entry& e : entries) {
+                MemoryUsage usage = e.reporter();
+                totals[e.name].allocated += usage.allocated;
+                totals[e.name].resident += usage.resident;
+            }
+        }
+
+        MemoryUsage sum;
+        std::printf("\nMemory (KiB)                 allocated   resident\n");
+        for (const auto& [name, usage] : totals) {
+            std::printf("  %-26s %10zu %10zu\n", name.c_str(), usage.allocated / 1024, usage.resident / 1024);
+            sum.allocated += usage.allocated;
+            sum.resident += usage.resident;
+        }
+        std::printf("  %-26s %10zu %10zu\n", "Total", sum.allocated / 1024, sum.resident / 1024);
+
+        long rss = processRssKiB();
+        if (rss >= 0) std::printf("  %-26s %21ld\n", "Process RSS (/proc)", rss);
+        std::fflush(stdout);
+    }
+
+private:
+    struct Entry {
+        int handle;
+        std::string name;
+        Reporter reporter;
+    };
+
+    mutable std::mutex mutex;
+    std::vector<Entry> entries;
+    int nextHandle = 1;
+
+    // VmRSS from /proc/self/status, -1 where unavailable
+    static long processRssKiB() {
+        FILE* file = std::fopen("/proc/self/status", "r");
+        if (!file) return -1;
+        char line[256];
+        long rss = -1;
+        while (std::fgets(line, sizeof(line), file)) {
+            if (std::sscanf(line, "VmRSS: %ld kB", &rss) == 1) break;
+        }
+        std::fclose(file);
+        return rss;
+    }
+};
+
+MemoryRegistry memoryRegistry;
+
+// --- Tracing ---
+// Each thread appends to its own fixed-size ring, so recording is a timestamp and a store.
+// Rings are kept after their thread exits (and reused by the next new thread) so they can still be dumped.
+// The ring list only ever grows at its head, so dumps (including the crash handler's) walk it without locking.
+
+enum class TraceEvent : uint8_t {
+    IterationStart,
+    IterationEnd,
+    MoveCommit,
+    TTResize,
+    Render,
+    InputReceived
+};
+
+struct TraceRecord {
+    uint64_t timestampNs;
+    uint32_t arg;
+    TraceEvent event;
+};
+
+struct TraceRing {
+    static constexpr size_t Size = 4096; // Power of two
+    std::array<TraceRecord, Size> records;
+    std::atomic<uint64_t> head{ 0 };
+    std::atomic<bool> retired{ false };
+    int threadId = 0;
+    TraceRing* next = nullptr;
+};
+
+std::atomic<bool> traceEnabled{ false };
+const auto traceEpoch = std::chrono::steady_clock::now();
+std::mutex traceRingsMutex; // Serialises adding rings, readers do not take it
+std::atomic<TraceRing*> traceRings{ nullptr };
+
+// Claims a retired ring or allocates a new one, only taken once per thread
+TraceRing* acquireTraceRing() {
+    std::lock_guard<std::mutex> lock(traceRingsMutex);
+    TraceRing* head = traceRings.load(std::memory_order_relaxed);
+    for (TraceRing* ring = head; ring; ring = ring->next) {
+        bool expected = true;
+        if (ring->retired.compare_exchange_strong(expected, false)) return ring;
+    }
+    TraceRing* ring = new TraceRing();
+    ring->threadId = head ? head->threadId + 1 : 1;
+    ring->next = head;
+    traceRings.store(ring, std::memory_order_release);
+    return ring;
+}
+
+struct ThreadTraceRing {
+    TraceRing* ring = acquireTraceRing();
+    ~ThreadTraceRing() { ring->retired = true; }
+};
+
+inline void trace(TraceEvent event, uint32_t arg = 0) {
+    if (!traceEnabled.load(std::memory_order_relaxed)) return;
+    thread_local ThreadTraceRing local;
+    TraceRing* ring = local.ring;
+
+    uint64_t index = ring->head.load(std::memory_order_relaxed);
+    TraceRecord& record = ring->records[index & (TraceRing::Size - 1)];
+    record.timestampNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - traceEpoch).count();
+    record.arg = arg;
+    record.event = event;
+    ring->head.store(index + 1, std::memory_order_release);
+}
+
+// Formats into a fixed buffer and writes it out in blocks, without allocating or locking, so
+// the crash handler can use it. On Linux it writes with write(2), which is async-signal-safe.
+class TraceWriter {
+public:
+#ifdef __linux__
+    explicit TraceWriter(int descriptor) : fd(descriptor) {}
+#else
+    explicit TraceWriter(FILE* stream) : file(stream) {}
+#endif
+
+    void put(const char* text) {
+        while (*text) putChar(*text++);
+    }
+
+    void putNumber(uint64_t value, int minDigits = 1) {
+        char digits[20];
+        int count = 0;
+        do {
+            digits[count++] = (char)('0' + value % 10);
+            value /= 10;
+        } while (value > 0 || count < minDigits);
+        while (count > 0) putChar(digits[--count]);
+    }
+
+    // Returns false if any write failed
+    bool flush() {
+        size_t done = 0;
+        while (ok && done < used) {
+#ifdef __linux__
+            ssize_t n = write(fd, buffer + done, used - done);
+            if (n < 0 && errno == EINTR) continue;
+#else
+            size_t n = std::fwrite(buffer + done, 1, used - done, file);
+            if (n == 0) n = (size_t)-1;
+#endif
+            if (n <= 0) ok = false;
+            else done += (size_t)n;
+        }
+        used = 0;
+        return ok;
+    }
+
+private:
+#ifdef __linux__
+    int fd;
+#else
+    FILE* file;
+#endif
+    char buffer[4096];
+    size_t used = 0;
+    bool ok = true;
+
+    void putChar(char c) {
+        if (used == sizeof(buffer)) flush();
+        buffer[used++] = c;
+    }
+};
+
+// Writes all rings as Chrome trace-event JSON (load in chrome://tracing or Perfetto).
+// Records being overwritten while dumping may come out torn, which is fine for a diagnostic.
+bool writeTrace(TraceWriter& out) {
+    static const char* const names[] = { "iteration", "iteration", "move commit", "tt resize", "render", "input" };
+    out.put("{\"traceEvents\":[\n");
+    bool first = true;
+    for (TraceRing* ring = traceRings.load(std::memory_order_acquire); ring; ring = ring->next) {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t begin = (head > TraceRing::Size) ? head - TraceRing::Size : 0;
+        for (uint64_t i = begin; i < head; i++) {
+            const TraceRecord& record = ring->records[i & (TraceRing::Size - 1)];
+            const char* phase = (record.event == TraceEvent::IterationStart) ? "B"
+                : (record.event == TraceEvent::IterationEnd) ? "E" : "i";
+            out.put(first ? "{\"name\":\"" : ",\n{\"name\":\"");
+            out.put(names[(int)record.event]);
+            out.put("\",\"ph\":\"");
+            out.put(phase);
+            out.put("\",\"ts\":"); // Microseconds
+            out.putNumber(record.timestampNs / 1000);
+            out.put(".");
+            out.putNumber(record.timestampNs % 1000, 3);
+            out.put(",\"pid\":1,\"tid\":");
+            out.putNumber((uint64_t)ring->threadId);
+            out.put(",\"s\":\"t\",\"args\":{\"arg\":");
+            out.putNumber(record.arg);
+            out.put("}}");
+            first = false;
+        }
+    }
+    out.put("\n]}\n");
+    return out.flush();
+}
+
+bool dumpTrace(const char* path) {
+#ifdef __linux__
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    TraceWriter out(fd);
+    bool ok = writeTrace(out);
+    return close(fd) == 0 && ok;
+#else
+    FILE* file = std::fopen(path, "w");
+    if (!file) return false;
+    TraceWriter out(file);
+    bool ok = writeTrace(out);
+    return std::fclose(file) == 0 && ok;
+#endif
+}
+
+constexpr const char* traceFile = "trace.json";
+
+// Resident counts only the slots each ring has written so far
+const int traceMemoryHandle = memoryRegistry.add("Trace rings", []() {
+    MemoryUsage usage;
+    for (TraceRing* ring = traceRings.load(std::memory_order_acquire); ring; ring = ring->next) {
+        uint64_t written = std::min<uint64_t>(ring->head.load(std::memory_order_relaxed), TraceRing::Size);
+        usage.allocated += sizeof(TraceRing);
+        usage.resident += written * sizeof(TraceRecord);
+    }
+    return usage;
+});
+
+// Best effort: dumps the rings on a crash, then lets the default handler terminate.
+// Only the first crashing thread dumps. Elsewhere than Linux the trace is written at exit only.
+#ifdef __linux__
+void traceCrashHandler(int sig) {
+    static std::atomic<bool> dumping{ false };
+    if (!dumping.exchange(true)) dumpTrace(traceFile);
+    std::signal(sig, SIG_DFL);
+    std::raise(sig);
+}
+#endif
+
+void enableTracing() {
+    traceEnabled = true;
+#ifdef __linux__
+    std::signal(SIGSEGV, traceCrashHandler);
+    std::signal(SIGABRT, traceCrashHandler);
+    std::signal(SIGFPE, traceCrashHandler);
+#endif
+}
+
+// --- Input Latency ---
+// Log-linear buckets in the style of HdrHistogram: 16 linear sub-buckets per power of two (~6% precision)
+
+class LatencyHistogram {
+public:
+    void record(uint64_t us) {
+        counts[bucketOf(us)]++;
+        total++;
+        if (us > maxValue) maxValue = us;
+    }
+
+    uint64_t count() const { return total; }
+    uint64_t max() const { return maxValue; }
+
+    // Highest value equivalent to the bucket holding the given percentile
+    uint64_t percentile(double p) const {
+        if (total == 0) return 0;
+        uint64_t rank = (uint64_t)std::ceil(p / 100.0 * total);
+        if (rank == 0) rank = 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); i++) {
+            seen += counts[i];
+            if (seen >= rank) return std::min(bucketTop(i), maxValue);
+        }
+        return maxValue;
+    }
+
+private:
+    static constexpr int subBuckets = 16;
+    std::array<uint64_t, 61 * subBuckets> counts = { 0 };
+    uint64_t total = 0;
+    uint64_t maxValue = 0;
+
+    static size_t bucketOf(uint64_t v) {
+        if (v < 2 * subBuckets) return (size_t)v;
+        int msb = 63;
+        while (!(v >> msb)) msb--;
+        int shift = msb - 4;
+        return (size_t)(shift + 1) * subBuckets + ((v >> shift) & (subBuckets - 1));
+    }
+
+    static uint64_t bucketTop(size_t index) {
+        if (index < 2 * subBuckets) return index;
+        int shift = (int)(index / subBuckets) - 1;
+        uint64_t sub = index % subBuckets;
+        return ((subBuckets + sub + 1) << shift) - 1;
+    }
+};
+
+// Timestamps each input from keystroke receipt through validation to the next frame flush
+class InputLatencyTracker {
+public:
+    void inputReceived() {
+        std::lock_guard<std::mutex> lock(mutex);
+        receivedAt = std::chrono::steady_clock::now();
+        pending = true;
+    }
+
+    void validated() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pending) validation.record(elapsedUs());
+    }
+
+    void frameFlushed() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!pending) return;
+        flush.record(elapsedUs());
+        pending = false;
+    }
+
+    void report() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (flush.count() == 0) return;
+        cout << "\nInput latency (us)          count      p50      p99      max\n";
+        printRow("  input -> validated     ", validation);
+        printRow("  input -> frame flushed ", flush);
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::chrono::steady_clock::time_point receivedAt;
+    bool pending = false;
+    LatencyHistogram validation;
+    LatencyHistogram flush;
+
+    uint64_t elapsedUs() const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - receivedAt).count();
+    }
+
+    static void printRow(const char* label, const LatencyHistogram& h) {
+        std::printf("%s %8llu %8llu %8llu %8llu\n", label, (unsigned long long)h.count(),
+            (unsigned long long)h.percentile(50), (unsigned long long)h.percentile(99), (unsigned long long)h.max());
+    }
+};
+
+InputLatencyTracker inputLatency;
+const int latencyMemoryHandle = memoryRegistry.add("Input latency histograms", []() {
+    return MemoryUsage{ sizeof(InputLatencyTracker), sizeof(InputLatencyTracker) };
+});
+
+// --- Zobrist Hashing ---
+
+// Deterministic keys so hashes (and anything stored with them) are stable across runs
+struct ZobristKeys {
+    std::array<std::array<uint64_t, 64>, 13> pieces; // [type + 6 if black][square]
+    uint64_t blackToMove;
+
+    ZobristKeys() {
+        uint64_t seed = 0x9E3779B97F4A7C15ull;
+        auto next = [&seed]() { // splitmix64
+            uint64_t z = (seed += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            return z ^ (z >> 31);
+        };
+        for (auto& squares : pieces) for (uint64_t& key : squares) key = next();
+        blackToMove = next();
+    }
+
+    uint64_t piece(uint8_t p, int square) const {
+        return pieces[(p & typeMask) + ((p & Piece::Black) ? 6 : 0)][square];
+    }
+
+    // Identifies this key set, anything persisted by hash key is only valid under the same one
+    uint64_t fingerprint() const {
+        uint64_t h = blackToMove;
+        for (const auto& squares : pieces) for (uint64_t key : squares) h = (h ^ key) * 0x100000001B3ull;
+        return h;
+    }
+};
+
+const ZobristKeys zobrist;
+
+// --- Slider Attacks ---
+// Compile-time choice of how Bishops, Rooks and Queens find their targets. The ray scan walks the
+// 8x8 array one square at a time and needs no tables. Hyperbola quintessence computes a whole line
+// at once from the occupancy bitboard, with 1.5 KiB of line masks and 512 bytes of rank attacks.
+// Bit i of a bitboard is square i (row * 8 + col, a8 first).
+
+#define SLIDER_RAYSCAN 0
+#define SLIDER_HYPERBOLA 1
+#ifndef SLIDER_BACKEND
+#define SLIDER_BACKEND SLIDER_RAYSCAN
+#endif
+
+struct SliderMasks {
+    std::array<uint64_t, 64> file, diagonal, antiDiagonal; // Excluding the square itself
+    std::array<std::array<uint8_t, 8>, 64> rank;            // [inner six bits of the rank][col]
+
+    SliderMasks() {
+        for (int sq = 0; sq < 64; sq++) {
+            int r = sq / 8, c = sq % 8;
+            file[sq] = diagonal[sq] = antiDiagonal[sq] = 0;
+            for (int i = 0; i < 8; i++) {
+                if (i != r) file[sq] |= 1ull << (i * 8 + c);
+                int dc = c + (i - r), ac = c - (i - r);
+                if (i != r && dc >= 0 && dc < 8) diagonal[sq] |= 1ull << (i * 8 + dc);
+                if (i != r && ac >= 0 && ac < 8) antiDiagonal[sq] |= 1ull << (i * 8 + ac);
+            }
+        }
+        for (int inner = 0; inner < 64; inner++) {
+            int occupied = inner << 1;
+            for (int c = 0; c < 8; c++) {
+                uint8_t attacks = 0;
+                for (int x = c + 1; x < 8; x++) { attacks |= 1 << x; if (occupied & (1 << x)) break; }
+                for (int x = c - 1; x >= 0; x--) { attacks |= 1 << x; if (occupied & (1 << x)) break; }
+                rank[inner][c] = attacks;
+            }
+        }
+    }
+};
+
+const SliderMasks sliderMasks;
+
+inline uint64_t byteSwap(uint64_t x) {
+#ifdef _MSC_VER
+    return _byteswap_uint64(x);
+#else
+    return __builtin_bswap64(x);
+#endif
+}
+
+// Attacks along one file or diagonal: the byte swap turns "nearest blocker below" into "above"
+inline uint64_t lineAttacks(int sq, uint64_t occupied, uint64_t mask) {
+    uint64_t bit = 1ull << sq;
+    uint64_t forward = occupied & mask;
+    uint64_t reverse = byteSwap(forward);
+    forward -= bit;
+    reverse -= byteSwap(bit);
+    return (forward ^ byteSwap(reverse)) & mask;
+}
+
+inline uint64_t rankAttacks(int sq, uint64_t occupied) {
+    int shift = sq & 56;
+    return (uint64_t)sliderMasks.rank[(occupied >> (shift + 1)) & 63][sq & 7] << shift;
+}
+
+inline uint64_t rookAttacks(int sq, uint64_t occupied) {
+    return lineAttacks(sq, occupied, sliderMasks.file[sq]) | rankAttacks(sq, occupied);
+}
+
+inline uint64_t bishopAttacks(int sq, uint64_t occupied) {
+    return lineAttacks(sq, occupied, sliderMasks.diagonal[sq]) | lineAttacks(sq, occupied, sliderMasks.antiDiagonal[sq]);
+}
+
+inline int popLowest(uint64_t& bits) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+#else
+    int index = __builtin_ctzll(bits);
+#endif
+    bits &= bits - 1;
+    return (int)index;
+}
+
+// Placement field of a FEN string, 'pieceAt' gives the piece on a square (row * 8 + col)
+template <class PieceAt>
+std::string fenPlacement(PieceAt pieceAt) {
+    static const char letters[] = " pnbrqk";
+    std::string fen;
+    for (int row = 0; row < 8; row++) {
+        int empty = 0;
+        for (int col = 0; col < 8; col++) {
+            uint8_t p = pieceAt(row * 8 + col);
+            if (p == Piece::None) { empty++; continue; }
+            if (empty) fen += char('0' + empty);
+            empty = 0;
+            char letter = letters[p & typeMask];
+            fen += (p & Piece::White) ? char(letter - 'a' + 'A') : letter;
+        }
+        if (empty) fen += char('0' + empty);
+        if (row < 7) fen += '/';
+    }
+    return fen;
+}
+
+class ChessBoard;
+
+// Set when an opening book is loaded, the interactive game shows its moves at the start of each turn
+std::function<void(const ChessBoard&, bool)> showBookMoves;
+
 class ChessBoard {
 private:
     std::array<std::array<std::uint8_t, 8>, 8> board;
     std::array<std::uint8_t, 7> whitesTakenPieces = { 0 };
     std::array<std::uint8_t, 7> blacksTakenPieces = { 0 };
+    uint64_t hash = 0; // Placement only, the side to move is added by the search
+    uint64_t occupied = 0; // Bit per non-empty square, for the bitboard slider backend
+
+    // Attack maps, kept current by doMove/undoMove: how many pieces of each side attack a square
+    // (own pieces included, so defended squares count) and the set of squares with a nonzero count
+    static constexpr uint8_t NoSquare = 64;
+    std::array<std::array<uint8_t, 64>, 2> attackCount = {};
+    std::array<uint64_t, 2> attackedBy = {};
+    std::array<uint8_t, 2> kingSquare = { NoSquare, NoSquare };
 
     // Initialization
     void setTop() {
@@ -64,6 +645,112 @@ private:
                 this->board[row][col] = Piece::None;
     }
 
+    void computeHash() {
+        hash = 0;
+        for (int sq = 0; sq < 64; sq++)
+            if (board[sq / 8][sq % 8] != Piece::None) hash ^= zobrist.piece(board[sq / 8][sq % 8], sq);
+    }
+
+    void computeOccupancy() {
+        occupied = 0;
+        for (int sq = 0; sq < 64; sq++)
+            if (board[sq / 8][sq % 8] != Piece::None) occupied |= 1ull << sq;
+    }
+
+    void computeAttacks() {
+        attackCount = {};
+        attackedBy = {};
+        kingSquare = { NoSquare, NoSquare };
+        for (int sq = 0; sq < 64; sq++) {
+            uint8_t p = board[sq / 8][sq % 8];
+            if (p == Piece::None) continue;
+            updatePieceAttacks(sq / 8, sq % 8, 1);
+            if ((p & typeMask) == Piece::King) kingSquare[sideIndex(p & colorMask)] = (uint8_t)sq;
+        }
+    }
+
+    void addAttack(int side, int r, int c, int delta) {
+        int sq = r * 8 + c;
+        attackCount[side][sq] += delta;
+        if (attackCount[side][sq]) attackedBy[side] |= 1ull << sq;
+        else attackedBy[side] &= ~(1ull << sq);
+    }
+
+    // Adds (1) or removes (-1) every square the piece on (r, c) attacks, rays stop at the first piece
+    void updatePieceAttacks(int r, int c, int delta) {
+        static const int dirs[8][2] = { {-1,0}, {1,0}, {0,-1}, {0,1}, {-1,-1}, {-1,1}, {1,-1}, {1,1} };
+        static const int knightMoves[8][2] = { {-2,-1}, {-2,1}, {-1,-2}, {-1,2}, {1,-2}, {1,2}, {2,-1}, {2,1} };
+        auto onBoard = [](int nr, int nc) { return nr >= 0 && nr < 8 && nc >= 0 && nc < 8; };
+        uint8_t piece = board[r][c];
+        int side = sideIndex(piece & colorMask);
+        uint8_t type = piece & typeMask;
+        switch (type) {
+        case Piece::Pawn: {
+            int nr = r + ((piece & Piece::White) ? -1 : 1);
+            if (onBoard(nr, c - 1)) addAttack(side, nr, c - 1, delta);
+            if (onBoard(nr, c + 1)) addAttack(side, nr, c + 1, delta);
+            return;
+        }
+        case Piece::Knight:
+        case Piece::King: {
+            const int (*offsets)[2] = (type == Piece::Knight) ? knightMoves : dirs;
+            for (int i = 0; i < 8; i++)
+                if (onBoard(r + offsets[i][0], c + offsets[i][1])) addAttack(side, r + offsets[i][0], c + offsets[i][1], delta);
+            return;
+        }
+        default: {
+            int first = (type == Piece::Bishop) ? 4 : 0;
+            int last = (type == Piece::Rook) ? 4 : 8;
+            for (int d = first; d < last; d++) {
+                for (int nr = r + dirs[d][0], nc = c + dirs[d][1]; onBoard(nr, nc); nr += dirs[d][0], nc += dirs[d][1]) {
+                    addAttack(side, nr, nc, delta);
+                    if (board[nr][nc] != Piece::None) break;
+                }
+            }
+            return;
+        }
+        }
+    }
+
+    // (r, c) is empty: the rays of sliders reaching it now continue past it (1) or are cut back (-1).
+    // Only the ray segments beyond the square are touched.
+    void updateRaysThrough(int r, int c, int delta) {
+        static const int dirs[8][2] = { {-1,0}, {1,0}, {0,-1}, {0,1}, {-1,-1}, {-1,1}, {1,-1}, {1,1} };
+        auto onBoard = [](int nr, int nc) { return nr >= 0 && nr < 8 && nc >= 0 && nc < 8; };
+        for (int d = 0; d < 8; d++) {
+            int br = r - dirs[d][0], bc = c - dirs[d][1];
+            while (onBoard(br, bc) && board[br][bc] == Piece::None) { br -= dirs[d][0]; bc -= dirs[d][1]; }
+            if (!onBoard(br, bc)) continue;
+            uint8_t p = board[br][bc];
+            uint8_t type = p & typeMask;
+            if (type != Piece::Queen && type != ((d < 4) ? Piece::Rook : Piece::Bishop)) continue;
+            int side = sideIndex(p & colorMask);
+            for (int nr = r + dirs[d][0], nc = c + dirs[d][1]; onBoard(nr, nc); nr += dirs[d][0], nc += dirs[d][1]) {
+                addAttack(side, nr, nc, delta);
+                if (board[nr][nc] != Piece::None) break;
+            }
+        }
+    }
+
+    void removePiece(int r, int c) {
+        updatePieceAttacks(r, c, -1);
+        board[r][c] = Piece::None;
+        updateRaysThrough(r, c, 1);
+    }
+
+    void placePiece(int r, int c, uint8_t p) {
+        updateRaysThrough(r, c, -1);
+        board[r][c] = p;
+        updatePieceAttacks(r, c, 1);
+    }
+
+    // Occupancy does not change, so no other piece's rays do
+    void replacePiece(int r, int c, uint8_t p) {
+        updatePieceAttacks(r, c, -1);
+        board[r][c] = p;
+        updatePieceAttacks(r, c, 1);
+    }
+
     // --- Helpers ---
 
     bool checkFormat(const std::string& pos, int& row, int& col) const {
@@ -104,6 +791,19 @@ private:
             }
         }
 
+#if SLIDER_BACKEND == SLIDER_HYPERBOLA
+        // 2-3. Sliding, every set bit is the first piece on its ray
+        for (uint64_t hits = rookAttacks(r * 8 + c, occupied); hits;) {
+            int sq = popLowest(hits);
+            uint8_t p = board[sq / 8][sq % 8];
+            if ((p & colorMask) == attackerColor && ((p & typeMask) == Piece::Rook || (p & typeMask) == Piece::Queen)) return true;
+        }
+        for (uint64_t hits = bishopAttacks(r * 8 + c, occupied); hits;) {
+            int sq = popLowest(hits);
+            uint8_t p = board[sq / 8][sq % 8];
+            if ((p & colorMask) == attackerColor && ((p & typeMask) == Piece::Bishop || (p & typeMask) == Piece::Queen)) return true;
+        }
+#else
         // 2. Sliding (Rook/Queen)
         int straightDirs[4][2] = { {-1,0}, {1,0}, {0,-1}, {0,1} };
         for (auto& dir : straightDirs) {
@@ -135,6 +835,7 @@ private:
                 }
             }
         }
+#endif
 
         // 4. Pawn Attacks
         int pawnRowDir = (attackerColor == Piece::White) ? 1 : -1; // Invert check direction
@@ -162,6 +863,51 @@ private:
         return false;
     }
 
+    // Finds the lowest valued piece of 'attackerColor' attacking (r, c), used by the exchange evaluation
+    bool leastValuableAttacker(int r, int c, uint8_t attackerColor, int& ar, int& ac) const {
+        static const int dirs[8][2] = { {-1,0}, {1,0}, {0,-1}, {0,1}, {-1,-1}, {-1,1}, {1,-1}, {1,1} };
+        static const int knightMoves[8][2] = { {-2,-1}, {-2,1}, {-1,-2}, {-1,2}, {1,-2}, {1,2}, {2,-1}, {2,1} };
+        int bestType = 7;
+        auto consider = [&](int nr, int nc, bool (*canAttack)(uint8_t)) {
+            if (nr < 0 || nr >= 8 || nc < 0 || nc >= 8) return;
+            uint8_t p = board[nr][nc];
+            if (p == Piece::None || (p & colorMask) != attackerColor || !canAttack(p & typeMask)) return;
+            if ((p & typeMask) < bestType) { bestType = p & typeMask; ar = nr; ac = nc; }
+        };
+
+        int pawnRowDir = (attackerColor == Piece::White) ? 1 : -1;
+        consider(r + pawnRowDir, c - 1, [](uint8_t t) { return t == Piece::Pawn; });
+        consider(r + pawnRowDir, c + 1, [](uint8_t t) { return t == Piece::Pawn; });
+        if (bestType == Piece::Pawn) return true;
+
+        for (auto& move : knightMoves) consider(r + move[0], c + move[1], [](uint8_t t) { return t == Piece::Knight; });
+#if SLIDER_BACKEND == SLIDER_HYPERBOLA
+        for (int d = 0; d < 8; d++) consider(r + dirs[d][0], c + dirs[d][1], [](uint8_t t) { return t == Piece::King; });
+        for (uint64_t hits = rookAttacks(r * 8 + c, occupied); hits;) {
+            int sq = popLowest(hits);
+            consider(sq / 8, sq % 8, [](uint8_t t) { return t == Piece::Rook || t == Piece::Queen; });
+        }
+        for (uint64_t hits = bishopAttacks(r * 8 + c, occupied); hits;) {
+            int sq = popLowest(hits);
+            consider(sq / 8, sq % 8, [](uint8_t t) { return t == Piece::Bishop || t == Piece::Queen; });
+        }
+#else
+        for (int d = 0; d < 8; d++) {
+            consider(r + dirs[d][0], c + dirs[d][1], [](uint8_t t) { return t == Piece::King; });
+            for (int dist = 1; dist < 8; dist++) {
+                int nr = r + dirs[d][0] * dist;
+                int nc = c + dirs[d][1] * dist;
+                if (nr < 0 || nr >= 8 || nc < 0 || nc >= 8) break;
+                if (board[nr][nc] == Piece::None) continue;
+                if (d < 4) consider(nr, nc, [](uint8_t t) { return t == Piece::Rook || t == Piece::Queen; });
+                else consider(nr, nc, [](uint8_t t) { return t == Piece::Bishop || t == Piece::Queen; });
+                break;
+            }
+        }
+#endif
+        return bestType != 7;
+    }
+
     // Checks "Geometry" only (how pieces move, ignoring checks)
     bool validateGeometry(int currR, int currC, int moveR, int moveC) const {
         uint8_t piece = board[currR][currC];
@@ -223,12 +969,36 @@ private:
         // 1. Check Geometry
         if (!validateGeometry(currR, currC, moveR, moveC)) return false;
 
+        return leavesKingSafe(currR, currC, moveR, moveC);
+    }
+
+    // Assumes the geometry is already valid, only checks for self-check
+    bool leavesKingSafe(int currR, int currC, int moveR, int moveC) {
+
+        // 1. Answer from the attack maps when they can: a pinned piece is always attacked by its pinner,
+        // and a King that is not in check has no slider lined up behind it
+        uint8_t mover = board[currR][currC];
+        int side = sideIndex(mover & colorMask);
+        int king = kingSquare[side];
+        if (king != NoSquare) {
+            uint64_t enemyAttacks = attackedBy[side ^ 1];
+            bool inCheckNow = (enemyAttacks >> king) & 1;
+            if ((mover & typeMask) == Piece::King) {
+                if ((enemyAttacks >> (moveR * 8 + moveC)) & 1) return false;
+                if (!inCheckNow) return true;
+            } else if (!inCheckNow && !((enemyAttacks >> (currR * 8 + currC)) & 1)) {
+                return true;
+            }
+        }
+
         // 2. Simulate Move
         uint8_t originalSource = board[currR][currC];
         uint8_t originalDest = board[moveR][moveC];
 
+        uint64_t originalOccupied = occupied;
         board[moveR][moveC] = originalSource;
         board[currR][currC] = Piece::None;
+        occupied = (occupied & ~(1ull << (currR * 8 + currC))) | (1ull << (moveR * 8 + moveC));
 
         // 3. Am I in Check?
         uint8_t myColor = originalSource & colorMask;
@@ -241,6 +1011,7 @@ private:
         // 4. Undo Move
         board[currR][currC] = originalSource;
         board[moveR][moveC] = originalDest;
+        occupied = originalOccupied;
 
         return !inCheck;
     }
@@ -263,6 +1034,77 @@ private:
         return false;
     }
 
+    // Pushes a move if it does not leave our own King in check
+    void tryAddMove(int r, int c, int tr, int tc, std::vector<Move>& moves) {
+        if (leavesKingSafe(r, c, tr, tc))
+            moves.push_back({ (uint8_t)(r * 8 + c), (uint8_t)(tr * 8 + tc), board[tr][tc] });
+    }
+
+    // Enumerates the targets of one piece directly instead of trying all 64 squares
+    void addPieceMoves(int r, int c, std::vector<Move>& moves) {
+        uint8_t piece = board[r][c];
+        uint8_t myColor = piece & colorMask;
+        auto onBoard = [](int nr, int nc) { return nr >= 0 && nr < 8 && nc >= 0 && nc < 8; };
+        auto isEnemy = [&](int nr, int nc) {
+            return board[nr][nc] != Piece::None && (board[nr][nc] & colorMask) != myColor;
+        };
+
+        switch (piece & typeMask) {
+        case Piece::Pawn: {
+            int direction = (piece & Piece::White) ? -1 : 1;
+            int startRow = (piece & Piece::White) ? 6 : 1;
+            int nr = r + direction;
+            if (nr < 0 || nr >= 8) return;
+            if (board[nr][c] == Piece::None) {
+                tryAddMove(r, c, nr, c, moves);
+                if (r == startRow && board[nr + direction][c] == Piece::None) tryAddMove(r, c, nr + direction, c, moves);
+            }
+            if (c > 0 && isEnemy(nr, c - 1)) tryAddMove(r, c, nr, c - 1, moves);
+            if (c < 7 && isEnemy(nr, c + 1)) tryAddMove(r, c, nr, c + 1, moves);
+            return;
+        }
+        case Piece::Knight:
+        case Piece::King: {
+            static const int knightMoves[8][2] = { {-2,-1}, {-2,1}, {-1,-2}, {-1,2}, {1,-2}, {1,2}, {2,-1}, {2,1} };
+            static const int kingMoves[8][2] = { {-1,-1}, {-1,0}, {-1,1}, {0,-1}, {0,1}, {1,-1}, {1,0}, {1,1} };
+            const int (*offsets)[2] = ((piece & typeMask) == Piece::Knight) ? knightMoves : kingMoves;
+            for (int i = 0; i < 8; i++) {
+                int nr = r + offsets[i][0];
+                int nc = c + offsets[i][1];
+                if (onBoard(nr, nc) && (board[nr][nc] == Piece::None || isEnemy(nr, nc))) tryAddMove(r, c, nr, nc, moves);
+            }
+            return;
+        }
+        default: {
+            uint8_t type = piece & typeMask;
+#if SLIDER_BACKEND == SLIDER_HYPERBOLA
+            uint64_t targets = 0;
+            if (type != Piece::Bishop) targets |= rookAttacks(r * 8 + c, occupied);
+            if (type != Piece::Rook) targets |= bishopAttacks(r * 8 + c, occupied);
+            while (targets) {
+                int sq = popLowest(targets);
+                if (board[sq / 8][sq % 8] == Piece::None || isEnemy(sq / 8, sq % 8)) tryAddMove(r, c, sq / 8, sq % 8, moves);
+            }
+#else
+            static const int dirs[8][2] = { {-1,0}, {1,0}, {0,-1}, {0,1}, {-1,-1}, {-1,1}, {1,-1}, {1,1} };
+            int first = (type == Piece::Bishop) ? 4 : 0;
+            int last = (type == Piece::Rook) ? 4 : 8;
+            for (int d = first; d < last; d++) {
+                for (int dist = 1; dist < 8; dist++) {
+                    int nr = r + dirs[d][0] * dist;
+                    int nc = c + dirs[d][1] * dist;
+                    if (!onBoard(nr, nc)) break;
+                    if (board[nr][nc] == Piece::None) { tryAddMove(r, c, nr, nc, moves); continue; }
+                    if (isEnemy(nr, nc)) tryAddMove(r, c, nr, nc, moves);
+                    break;
+                }
+            }
+#endif
+            return;
+        }
+        }
+    }
+
     std::string getPieceString(uint8_t piece, bool highlight = false) const {
         std::string s = "";
         char c = '.';
@@ -302,15 +1144,14 @@ public:
         setTop();
         setMiddle();
         setBottom();
+        computeHash();
+        computeOccupancy();
+        computeAttacks();
     }
 
     // Returns the state of the opponent (Check, Mate, etc.)
     GameState getGameState(uint8_t playerColor) {
-        int kR, kC;
-        uint8_t enemyColor = (playerColor == Piece::White) ? Piece::Black : Piece::White;
-        findKing(playerColor, kR, kC);
-
-        bool inCheck = isSquareAttacked(kR, kC, enemyColor);
+        bool inCheck = isInCheck(playerColor);
         bool hasMoves = hasAnyLegalMoves(playerColor);
 
         if (inCheck && !hasMoves) return GameState::Checkmate;
@@ -319,27 +1160,259 @@ public:
         return GameState::Playing;
     }
 
+    // --- Engine Interface ---
+    // The engine follows the same rules as the interactive game (no castling, en passant or promotion)
+
+    uint8_t pieceAt(int r, int c) const { return board[r][c]; }
+
+    bool isInCheck(uint8_t color) const {
+        int side = sideIndex(color);
+        return kingSquare[side] != NoSquare && ((attackedBy[side ^ 1] >> kingSquare[side]) & 1);
+    }
+
+    // Attack map lookup, 'color' is the attacking side
+    bool isAttackedBy(int sq, uint8_t color) const { return (attackedBy[sideIndex(color)] >> sq) & 1; }
+
+    // True if the move attacks the enemy King, directly or by discovery
+    bool givesCheck(const Move& m) {
+        uint8_t piece = board[m.from / 8][m.from % 8];
+        int us = sideIndex(piece & colorMask);
+        int king = kingSquare[us ^ 1];
+        if (king == NoSquare) return false;
+        int kr = king / 8, kc = king % 8, tr = m.to / 8, tc = m.to % 8;
+        // Occupancy after the move, without making it
+        auto emptyAfter = [&](int r, int c) {
+            int sq = r * 8 + c;
+            return sq == m.from || (sq != m.to && board[r][c] == Piece::None);
+        };
+        auto clearBetween = [&](int r, int c, int dr, int dc) {
+            for (r += dr, c += dc; r != kr || c != kc; r += dr, c += dc)
+                if (!emptyAfter(r, c)) return false;
+            return true;
+        };
+
+        // Direct: the moved piece attacks the King from its new square
+        int dr = kr - tr, dc = kc - tc;
+        uint8_t type = piece & typeMask;
+        bool straight = (dr == 0 || dc == 0), diagonal = (std::abs(dr) == std::abs(dc));
+        switch (type) {
+        case Piece::Pawn:
+            if (dr == ((piece & Piece::White) ? -1 : 1) && std::abs(dc) == 1) return true;
+            break;
+        case Piece::Knight:
+            if (std::abs(dr) * std::abs(dc) == 2) return true;
+            break;
+        case Piece::King:
+            break;
+        default:
+            if ((type != Piece::Bishop && straight) || (type != Piece::Rook && diagonal))
+                if (clearBetween(tr, tc, (dr > 0) - (dr < 0), (dc > 0) - (dc < 0))) return true;
+            break;
+        }
+
+        // Discovered: only a slider of ours that already attacks m.from can see through it
+        if (!((attackedBy[us] >> m.from) & 1)) return false;
+        int fr = m.from / 8, fc = m.from % 8;
+        dr = fr - kr;
+        dc = fc - kc;
+        bool lineStraight = (dr == 0 || dc == 0);
+        if (!lineStraight && std::abs(dr) != std::abs(dc)) return false;
+        int stepR = (dr > 0) - (dr < 0), stepC = (dc > 0) - (dc < 0);
+        int r = kr + stepR, c = kc + stepC;
+        while (r >= 0 && r < 8 && c >= 0 && c < 8 && emptyAfter(r, c)) { r += stepR; c += stepC; }
+        if (r < 0 || r >= 8 || c < 0 || c >= 8 || (r == tr && c == tc)) return false;
+        uint8_t p = board[r][c];
+        if ((p & colorMask) != (piece & colorMask)) return false;
+        return (p & typeMask) == Piece::Queen || (p & typeMask) == (lineStraight ? Piece::Rook : Piece::Bishop);
+    }
+
+    // Static exchange evaluation: material balance of the capture sequence on m.to when both
+    // sides always recapture with their least valuable attacker (pins are ignored)
+    int see(const Move& m) {
+        static const int seeValues[7] = { 0, 100, 320, 330, 500, 900, 10000 };
+        // Nothing can recapture: no attacker on m.to, and none behind m.from that could see through it
+        uint8_t opponent = (board[m.from / 8][m.from % 8] & Piece::White) ? Piece::Black : Piece::White;
+        if (!isAttackedBy(m.to, opponent) && !isAttackedBy(m.from, opponent)) return seeValues[m.captured & typeMask];
+
+        std::array<int, 32> gain;
+        std::array<std::pair<int, uint8_t>, 64> saved; // Squares to restore, in order of change
+        int savedCount = 0;
+        uint64_t savedOccupied = occupied;
+        auto setSquare = [&](int sq, uint8_t p) {
+            saved[savedCount++] = { sq, board[sq / 8][sq % 8] };
+            board[sq / 8][sq % 8] = p;
+            occupied = (p == Piece::None) ? occupied & ~(1ull << sq) : occupied | (1ull << sq);
+        };
+
+        int tr = m.to / 8, tc = m.to % 8;
+        uint8_t mover = board[m.from / 8][m.from % 8];
+        gain[0] = seeValues[board[tr][tc] & typeMask];
+        setSquare(m.from, Piece::None);
+        setSquare(m.to, mover);
+
+        uint8_t side = (mover & Piece::White) ? Piece::Black : Piece::White;
+        int d = 0, ar, ac;
+        while (d < 30 && leastValuableAttacker(tr, tc, side, ar, ac)) {
+            d++;
+            gain[d] = seeValues[board[tr][tc] & typeMask] - gain[d - 1];
+            uint8_t next = board[ar][ac];
+            setSquare(ar * 8 + ac, Piece::None);
+            setSquare(m.to, next);
+            side = (side == Piece::White) ? Piece::Black : Piece::White;
+        }
+        while (savedCount > 0) {
+            savedCount--;
+            board[saved[savedCount].first / 8][saved[savedCount].first % 8] = saved[savedCount].second;
+        }
+        occupied = savedOccupied;
+
+        // Each side may stop recapturing when that is better for it
+        for (; d > 0; d--) gain[d - 1] = -std::max(-gain[d - 1], gain[d]);
+        return gain[0];
+    }
+
+    // Appends every legal move for 'color'
+    void generateMoves(uint8_t color, std::vector<Move>& moves) {
+        for (int r = 0; r < 8; r++)
+            for (int c = 0; c < 8; c++)
+                if (board[r][c] != Piece::None && (board[r][c] & colorMask) == color) addPieceMoves(r, c, moves);
+    }
+
+    uint64_t hashKey() const { return hash; }
+
+    // The placement hash after 'm', without making it
+    uint64_t hashAfter(const Move& m) const {
+        uint8_t piece = board[m.from / 8][m.from % 8];
+        uint64_t key = hash ^ zobrist.piece(piece, m.from) ^ zobrist.piece(piece, m.to);
+        if (m.captured != Piece::None) key ^= zobrist.piece(m.captured, m.to);
+        return key;
+    }
+
+    void doMove(const Move& m) {
+        uint8_t piece = board[m.from / 8][m.from % 8];
+        hash ^= zobrist.piece(piece, m.from) ^ zobrist.piece(piece, m.to);
+        if (m.captured != Piece::None) hash ^= zobrist.piece(m.captured, m.to);
+        removePiece(m.from / 8, m.from % 8);
+        if (m.captured != Piece::None) replacePiece(m.to / 8, m.to % 8, piece);
+        else placePiece(m.to / 8, m.to % 8, piece);
+        occupied = (occupied & ~(1ull << m.from)) | (1ull << m.to);
+        if ((piece & typeMask) == Piece::King) kingSquare[sideIndex(piece & colorMask)] = m.to;
+    }
+
+    void undoMove(const Move& m) {
+        uint8_t piece = board[m.to / 8][m.to % 8];
+        hash ^= zobrist.piece(piece, m.from) ^ zobrist.piece(piece, m.to);
+        if (m.captured != Piece::None) hash ^= zobrist.piece(m.captured, m.to);
+        if (m.captured != Piece::None) replacePiece(m.to / 8, m.to % 8, m.captured);
+        else removePiece(m.to / 8, m.to % 8);
+        placePiece(m.from / 8, m.from % 8, piece);
+        occupied |= 1ull << m.from;
+        if (m.captured == Piece::None) occupied &= ~(1ull << m.to);
+        if ((piece & typeMask) == Piece::King) kingSquare[sideIndex(piece & colorMask)] = m.from;
+    }
+
+    // Counts leaf nodes of the legal move tree
+    uint64_t perft(uint8_t color, int depth) {
+        std::vector<Move> moves;
+        moves.reserve(64);
+        generateMoves(color, moves);
+        if (depth <= 1) return (depth == 1) ? moves.size() : 1;
+
+        uint8_t enemyColor = (color == Piece::White) ? Piece::Black : Piece::White;
+        uint64_t nodes = 0;
+        for (const Move& m : moves) {
+            doMove(m);
+            nodes += perft(enemyColor, depth - 1);
+            undoMove(m);
+        }
+        return nodes;
+    }
+
+    // Loads the placement and side to move fields of a FEN string, the rest is ignored
+    bool loadFen(const std::string& fen, bool& isWhitesTurn) {
+        std::array<std::array<std::uint8_t, 8>, 8> parsed = {};
+        int row = 0, col = 0;
+        size_t i = 0;
+        for (; i < fen.size() && fen[i] != ' '; i++) {
+            char ch = fen[i];
+            if (ch == '/') {
+                if (col != 8) return false;
+                row++; col = 0;
+                continue;
+            }
+            if (ch >= '1' && ch <= '8') { col += ch - '0'; continue; }
+
+            uint8_t type = Piece::None;
+            switch (ch | 32) {
+            case 'p': type = Piece::Pawn; break;
+            case 'n': type = Piece::Knight; break;
+            case 'b': type = Piece::Bishop; break;
+            case 'r': type = Piece::Rook; break;
+            case 'q': type = Piece::Queen; break;
+            case 'k': type = Piece::King; break;
+            default: return false;
+            }
+            if (row > 7 || col > 7) return false;
+            parsed[row][col++] = type | ((ch >= 'a') ? Piece::Black : Piece::White);
+        }
+        if (row != 7 || col != 8) return false;
+
+        board = parsed;
+        computeHash();
+        computeOccupancy();
+        computeAttacks();
+        whitesTakenPieces.fill(0);
+        blacksTakenPieces.fill(0);
+        isWhitesTurn = !(i + 1 < fen.size() && fen[i + 1] == 'b');
+        return true;
+    }
+
+    // Full FEN, the castling and en passant fields are always empty in this game
+    std::string toFen(bool isWhitesTurn) const {
+        return fenPlacement([this](int sq) { return board[sq / 8][sq % 8]; }) + (isWhitesTurn ? " w - - 0 1" : " b - - 0 1");
+    }
+
     void makeMove(bool isWhitesTurn, bool& isRunning) {
         std::string pos1, pos2;
-        int currR, currC, moveR, moveC;
+        int currR = 0, currC = 0, moveR = 0, moveC = 0;
 
         while (true) {
+            if (showBookMoves) showBookMoves(*this, isWhitesTurn);
             cout << "\nPiece to move " << ((isWhitesTurn) ? "(white)" : "(black)") << " : ";
 
             while (true) {
                 std::cin >> pos1;
-                if (checkFormat(pos1, currR, currC) && checkColor(isWhitesTurn, this->board[currR][currC])) {
-                    break;
+                inputLatency.inputReceived();
+                trace(TraceEvent::InputReceived);
+                if (!std::cin || pos1 == "quit") {
+                    isRunning = false;
+                    return;
+                }
+                if (pos1 == "mem") {
+                    memoryRegistry.report();
+                    cout << "Piece to move: ";
+                    continue;
+                }
+                if (pos1 == "trace") {
+                    cout << (dumpTrace(traceFile) ? "Trace written to trace.json: " : "Could not write trace.json: ");
+                    continue;
                 }
+                bool isValid = checkFormat(pos1, currR, currC) && checkColor(isWhitesTurn, this->board[currR][currC]);
+                inputLatency.validated();
+                if (isValid) break;
                 cout << "Invalid selection. Try again: ";
             }
 
             cout << "\033[H\033[2J";
 
             // FLICKER THREAD
-            std::atomic<bool> keepFlickering{ true };
-            std::thread flickerThread([this, &keepFlickering, currR, currC]() {
+            // Waits on a condition variable rather than sleeping, so the join below does not stall up to 400 ms
+            std::mutex flickerMutex;
+            std::condition_variable flickerWake;
+            bool keepFlickering = true;
+            std::thread flickerThread([this, &flickerMutex, &flickerWake, &keepFlickering, currR, currC]() {
                 bool highlight = false;
+                std::unique_lock<std::mutex> lock(flickerMutex);
                 while (keepFlickering) {
                     cout << "\033[H";
                     this->render(currR, currC, highlight);
@@ -347,28 +1420,43 @@ public:
                     cout << "\nSelected: " << (char)('a' + currC) << 8 - currR << "\n";
                     cout << "Move to (type 'x' to cancel): ";
                     cout.flush();
-                    std::this_thread::sleep_for(std::chrono::milliseconds(400));
+                    flickerWake.wait_for(lock, std::chrono::milliseconds(400), [&keepFlickering]() { return !keepFlickering; });
                 }
                 });
 
             std::cin >> pos2;
-            keepFlickering = false;
+            inputLatency.inputReceived();
+            trace(TraceEvent::InputReceived);
+            {
+                std::lock_guard<std::mutex> lock(flickerMutex);
+                keepFlickering = false;
+            }
+            flickerWake.notify_one();
             if (flickerThread.joinable()) flickerThread.join();
 
+            if (!std::cin) {
+                isRunning = false;
+                return;
+            }
+
             if (pos2 == "x" || pos2 == "X") {
+                inputLatency.validated();
                 cout << "\033[H\033[2J";
                 render();
                 continue;
             }
 
             if (!checkFormat(pos2, moveR, moveC)) {
+                inputLatency.validated();
                 cout << "\033[H\033[2J";
                 render();
                 cout << "\nInvalid format!\n";
                 continue;
             }
 
-            if (isSafeMove(currR, currC, moveR, moveC)) {
+            bool isLegal = isSafeMove(currR, currC, moveR, moveC);
+            inputLatency.validated();
+            if (isLegal) {
 
                 // Capture Logic
                 uint8_t target = this->board[moveR][moveC];
@@ -378,8 +1466,8 @@ public:
                 }
 
                 // Commit Move
-                board[moveR][moveC] = board[currR][currC];
-                board[currR][currC] = Piece::None;
+                doMove({ (uint8_t)(currR * 8 + currC), (uint8_t)(moveR * 8 + moveC), target });
+                trace(TraceEvent::MoveCommit, (currR * 8 + currC) << 8 | (moveR * 8 + moveC));
 
                 cout << "\033[H\033[2J";
                 render();
@@ -460,18 +1548,4132 @@ public:
         output += "\033[0m";
 
         std::cout << output << std::flush;
+        inputLatency.frameFlushed();
+        trace(TraceEvent::Render);
     }
 };
 
-int main() {
+// --- Search ---
+
+constexpr int MateScore = 30000;
+constexpr int InfiniteScore = 32000;
+constexpr int MaxPly = 64;
+constexpr int pieceValues[7] = { 0, 100, 320, 330, 500, 900, 0 };
+
+inline uint8_t opposite(uint8_t color) { return (color == Piece::White) ? Piece::Black : Piece::White; }
+
+// Long algebraic notation, e.g. "e2e4"
+std::string moveToString(const Move& m) {
+    std::string s;
+    s += (char)('a' + m.from % 8);
+    s += (char)('0' + 8 - m.from / 8);
+    s += (char)('a' + m.to % 8);
+    s += (char)('0' + 8 - m.to / 8);
+    return s;
+}
+
+inline bool sameMove(const Move& a, const Move& b) { return a.from == b.from && a.to == b.to; }
+
+// --- Transposition Table ---
+
+enum class Bound : uint8_t { None, Upper, Lower, Exact };
+
+struct TTEntry {
+    uint64_t key = 0;
+    int16_t score = 0;
+    uint8_t from = 0;
+    uint8_t to = 0;
+    int8_t depth = 0;
+    Bound bound = Bound::None;
+    uint8_t padding[2] = { 0 };
+};
+
+// Four entries per cache line, a probe touches a single line
+struct alignas(64) TTBucket {
+    std::array<TTEntry, 4> entries;
+};
+static_assert(sizeof(TTBucket) == 64, "A bucket must fill exactly one cache line");
+
+// Saved tables start with this header, the raw buckets follow it
+struct TTFileHeader {
+    char magic[8] = { 'C', 'H', 'E', 'S', 'S', 'T', 'T', '1' };
+    uint32_t formatVersion = 1;
+    uint32_t entrySize = sizeof(TTEntry);
+    uint64_t zobristFingerprint = 0;
+    uint64_t bucketCount = 0;
+    uint64_t rootKey = 0; // Position the table was saved from, 0 if none
+};
+
+class TranspositionTable {
+public:
+    TranspositionTable() {
+        memoryHandle = memoryRegistry.add("Transposition table", [this]() {
+            size_t bytes = buckets.size() * sizeof(TTBucket);
+            return MemoryUsage{ bytes, bytes }; // clear() touches every page
+        });
+    }
+
+    ~TranspositionTable() { memoryRegistry.remove(memoryHandle); }
+
+    TranspositionTable(const TranspositionTable&) = delete;
+    TranspositionTable& operator=(const TranspositionTable&) = delete;
+
+    // Rounds down to a power of two number of buckets
+    void resize(size_t megabytes) {
+        size_t count = 1;
+        while (count * 2 * sizeof(TTBucket) <= megabytes * 1024 * 1024) count *= 2;
+        trace(TraceEvent::TTResize, (uint32_t)megabytes);
+        buckets.assign(count, TTBucket{});
+        mask = count - 1;
+    }
+
+    void clear() { std::fill(buckets.begin(), buckets.end(), TTBucket{}); }
+
+    bool probe(uint64_t key, TTEntry& out) const {
+        const TTBucket& bucket = buckets[key & mask];
+        for (const TTEntry& e : bucket.entries) {
+            if (e.key == key && e.bound != Bound::None) { out = e; return true; }
+        }
+        return base && base->probe(key, out);
+    }
+
+    // Makes this table a private overlay: probes fall through to 'table' on a miss, stores stay here
+    void setBase(const TranspositionTable* table) { base = table; }
+
+    // Stores every entry into 'target' in bucket order, so merging is deterministic
+    void mergeInto(TranspositionTable& target) const {
+        for (const TTBucket& bucket : buckets) {
+            for (const TTEntry& e : bucket.entries) {
+                if (e.bound != Bound::None) target.store(e.key, e.depth, e.score, e.bound, Move{ e.from, e.to, Piece::None });
+            }
+        }
+    }
+
+    // Replaces the same position, else an empty slot, else the shallowest entry
+    // 'keepDeeper' leaves a deeper entry for the same position in place, for speculative shallow bounds
+    void store(uint64_t key, int depth, int score, Bound bound, const Move& move, bool keepDeeper = false) {
+        TTBucket& bucket = buckets[key & mask];
+        TTEntry* target = &bucket.entries[0];
+        for (TTEntry& e : bucket.entries) {
+            if (e.key == key || e.bound == Bound::None) { target = &e; break; }
+            if (e.depth < target->depth) target = &e;
+        }
+        if (keepDeeper && target->key == key && target->bound != Bound::None && target->depth > depth) return;
+        // Keep the old move if this search did not find one
+        bool keepMove = target->key == key && move.from == move.to;
+        target->key = key;
+        target->score = (int16_t)score;
+        target->depth = (int8_t)depth;
+        target->bound = bound;
+        if (!keepMove) { target->from = move.from; target->to = move.to; }
+    }
+
+    size_t sizeBytes() const { return buckets.size() * sizeof(TTBucket); }
+
+    bool save(const std::string& path, uint64_t rootKey = 0) const {
+        TTFileHeader header;
+        header.zobristFingerprint = zobrist.fingerprint();
+        header.bucketCount = buckets.size();
+        header.rootKey = rootKey;
+
+        // Written next to the target and renamed, an interrupted save keeps the previous file
+        std::string temp = path + ".tmp";
+        FILE* file = std::fopen(temp.c_str(), "wb");
+        if (!file) return false;
+        bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1
+            && std::fwrite(buckets.data(), sizeof(TTBucket), buckets.size(), file) == buckets.size();
+        ok = (std::fclose(file) == 0) && ok;
+        if (!ok || std::rename(temp.c_str(), path.c_str()) != 0) {
+            std::remove(temp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Replaces the table with a saved one, taking its size. 'rootKey' is only compared to warn
+    // about a different position, entries are keyed by position so they stay valid anyway.
+    bool load(const std::string& path, uint64_t rootKey = 0) {
+        TTFileHeader expected;
+        TTFileHeader header;
+#ifdef __linux__
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(header)) { close(fd); return false; }
+        size_t fileSize = (size_t)info.st_size;
+        void* mapped = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) return false;
+        madvise(mapped, fileSize, MADV_SEQUENTIAL);
+        std::memcpy(&header, mapped, sizeof(header));
+        bool ok = validHeader(header, expected) && sizeMatches(header, fileSize);
+        if (ok) {
+            trace(TraceEvent::TTResize, (uint32_t)(header.bucketCount * sizeof(TTBucket) >> 20));
+            buckets.resize(header.bucketCount);
+            std::memcpy((void*)buckets.data(), (const char*)mapped + sizeof(header), header.bucketCount * sizeof(TTBucket));
+            mask = header.bucketCount - 1;
+        }
+        munmap(mapped, fileSize);
+#else
+        std::error_code error;
+        uint64_t fileSize = std::filesystem::file_size(path, error);
+        if (error) return false;
+        FILE* file = std::fopen(path.c_str(), "rb");
+        if (!file) return false;
+        bool ok = std::fread(&header, sizeof(header), 1, file) == 1 && validHeader(header, expected) && sizeMatches(header, fileSize);
+        if (ok) {
+            trace(TraceEvent::TTResize, (uint32_t)(header.bucketCount * sizeof(TTBucket) >> 20));
+            buckets.resize(header.bucketCount);
+            ok = std::fread(buckets.data(), sizeof(TTBucket), buckets.size(), file) == buckets.size();
+            mask = header.bucketCount - 1;
+            if (!ok) clear();
+        }
+        std::fclose(file);
+#endif
+        if (ok && rootKey && header.rootKey != rootKey) cout << "Note: hash file was saved from a different position" << newline;
+        return ok;
+    }
+
+    // Starts loading the bucket for 'key' into cache without waiting for it
+    void prefetch(uint64_t key) const {
+#if TT_PREFETCH
+#ifdef _MSC_VER
+        _mm_prefetch((const char*)&buckets[key & mask], _MM_HINT_T0);
+#else
+        __builtin_prefetch(&buckets[key & mask]);
+#endif
+        if (base) base->prefetch(key);
+#else
+        (void)key;
+#endif
+    }
+
+private:
+    std::vector<TTBucket> buckets = std::vector<TTBucket>(1);
+    size_t mask = 0;
+    const TranspositionTable* base = nullptr;
+    int memoryHandle = 0;
+
+    // Tables from another build's keys or entry layout would only produce false hits
+    static bool validHeader(const TTFileHeader& header, const TTFileHeader& expected) {
+        return std::equal(std::begin(header.magic), std::end(header.magic), std::begin(expected.magic))
+            && header.formatVersion == expected.formatVersion
+            && header.entrySize == expected.entrySize
+            && header.zobristFingerprint == zobrist.fingerprint()
+            && header.bucketCount > 0 && (header.bucketCount & (header.bucketCount - 1)) == 0;
+    }
+
+    // Divides rather than multiplies, so a crafted bucket count cannot wrap around to match
+    static bool sizeMatches(const TTFileHeader& header, uint64_t fileSize) {
+        if (fileSize < sizeof(header)) return false;
+        uint64_t payload = fileSize - sizeof(header);
+        return header.bucketCount <= payload / sizeof(TTBucket) && payload == header.bucketCount * sizeof(TTBucket);
+    }
+};
+
+constexpr size_t defaultHashMB = 16;
+TranspositionTable transpositionTable;
+
+struct PVLine {
+    int score = 0;
+    std::vector<Move> moves;
+};
+
+// Shallow-depth pruning margins in centipawns, per ply of remaining depth, and extension limits.
+// Defaults were checked with 'selfplay' against the same search with the feature off.
+struct SearchParams {
+    bool pruning = true;
+    int maxPruneDepth = 3;
+    int reverseFutilityMargin = 120;
+    int razorMargin = 250;
+    int futilityMargin = 150;
+    int seeMargin = 100;
+
+    bool checkExtensions = true;
+    bool singularExtensions = true;
+    int maxExtensions = 6;      // Per path from the root, keeps checking sequences from exploding the tree
+    int singularMinDepth = 4;
+    int singularMargin = 20;    // Per ply of depth, how much better the TT move must be than the rest
+
+    bool probCut = true;
+    int probCutMinDepth = 5;
+    int probCutMargin = 200;    // How far above beta a reduced capture search has to land
+};
+
+SearchParams searchParams;
+
+// Parses 'name=value' (from '--param' or a selfplay reference), returns false for unknown names
+bool setSearchParam(SearchParams& params, const std::string& assignment) {
+    size_t eq = assignment.find('=');
+    if (eq == std::string::npos) return false;
+    std::string name = assignment.substr(0, eq);
+    int value = std::atoi(assignment.c_str() + eq + 1);
+    if (name == "pruning") params.pruning = value != 0;
+    else if (name == "maxPruneDepth") params.maxPruneDepth = value;
+    else if (name == "reverseFutilityMargin") params.reverseFutilityMargin = value;
+    else if (name == "razorMargin") params.razorMargin = value;
+    else if (name == "futilityMargin") params.futilityMargin = value;
+    else if (name == "seeMargin") params.seeMargin = value;
+    else if (name == "checkExtensions") params.checkExtensions = value != 0;
+    else if (name == "singularExtensions") params.singularExtensions = value != 0;
+    else if (name == "maxExtensions") params.maxExtensions = value;
+    else if (name == "singularMinDepth") params.singularMinDepth = value;
+    else if (name == "singularMargin") params.singularMargin = value;
+    else if (name == "probCut") params.probCut = value != 0;
+    else if (name == "probCutMinDepth") params.probCutMinDepth = value;
+    else if (name == "probCutMargin") params.probCutMargin = value;
+    else return false;
+    return true;
+}
+
+// How many nodes or moves each pruning rule removed, and how often each extension fired
+struct PruneStats {
+    uint64_t reverseFutility = 0;
+    uint64_t razoring = 0;
+    uint64_t futility = 0;
+    uint64_t see = 0;
+    uint64_t seeQuiescence = 0;
+    uint64_t checkExtensions = 0;
+    uint64_t singularTests = 0;
+    uint64_t singularExtensions = 0;
+    uint64_t probCutTries = 0;
+    uint64_t probCutCuts = 0;
+
+    void add(const PruneStats& o) {
+        reverseFutility += o.reverseFutility;
+        razoring += o.razoring;
+        futility += o.futility;
+        see += o.see;
+        seeQuiescence += o.seeQuiescence;
+        checkExtensions += o.checkExtensions;
+        singularTests += o.singularTests;
+        singularExtensions += o.singularExtensions;
+        probCutTries += o.probCutTries;
+        probCutCuts += o.probCutCuts;
+    }
+
+    void print() const {
+        cout << "Pruned: reverse futility " << reverseFutility << ", razoring " << razoring
+            << ", futility " << futility << ", SEE " << see << " (quiescence " << seeQuiescence << ")"
+            << ", ProbCut " << probCutCuts << " of " << probCutTries << " captures" << newline;
+        cout << "Extended: check " << checkExtensions << ", singular " << singularExtensions
+            << " of " << singularTests << " tests" << newline;
+    }
+};
+
+struct SearchResult {
+    Move best;
+    int score = 0;
+    int depth = 0;
+    uint64_t nodes = 0;
+    std::vector<Move> pv;
+    std::vector<PVLine> lines; // One per MultiPV line, best first
+};
+
+// --- NNUE Evaluation ---
+// 768 piece-square inputs per perspective -> NnueHidden clipped-ReLU units per perspective -> 1 output.
+// Both perspectives share the input weights: Black's sees the board flipped vertically with colors
+// swapped. The side to move's half comes first in the output layer. Files are written by 'train'.
+
+constexpr int NnueInputs = 768;
+constexpr int NnueHidden = 64;
+constexpr int NnueQA = 255;   // Input layer quantization, a hidden activation of 1.0 is QA
+constexpr int NnueQB = 64;    // Output weight quantization
+constexpr int NnueScale = 400; // Centipawns per unit of network output, the trainer's sigmoid scale
+constexpr char nnueMagic[8] = { 'C', 'H', 'E', 'S', 'S', 'N', 'N', '1' };
+
+// Input index of 'piece' on 'square' as seen from 'perspective'
+inline int nnueFeature(uint8_t piece, int square, uint8_t perspective) {
+    bool own = (piece & colorMask) == perspective;
+    int relative = (perspective == Piece::White) ? square : square ^ 56;
+    return ((own ? 0 : 6) + (piece & typeMask) - 1) * 64 + relative;
+}
+
+class NnueNetwork {
+public:
+    bool loaded = false;
+
+    bool load(const std::string& path) {
+        FILE* file = std::fopen(path.c_str(), "rb");
+        if (!file) return false;
+        char magic[8];
+        uint32_t hidden = 0;
+        bool ok = std::fread(magic, sizeof(magic), 1, file) == 1 && std::equal(magic, magic + 8, nnueMagic)
+            && std::fread(&hidden, sizeof(hidden), 1, file) == 1 && hidden == NnueHidden
+            && std::fread(inputWeights.data(), sizeof(int16_t), inputWeights.size(), file) == inputWeights.size()
+            && std::fread(inputBias.data(), sizeof(int16_t), inputBias.size(), file) == inputBias.size()
+            && std::fread(outputWeights.data(), sizeof(int16_t), outputWeights.size(), file) == outputWeights.size()
+            && std::fread(&outputBias, sizeof(outputBias), 1, file) == 1;
+        std::fclose(file);
+        loaded = ok;
+        return ok;
+    }
+
+    // Centipawns for 'color'. The accumulators are rebuilt from the board on every call.
+    int evaluate(const ChessBoard& board, uint8_t color) const {
+        alignas(32) std::array<int16_t, NnueHidden> own = inputBias;
+        alignas(32) std::array<int16_t, NnueHidden> other = inputBias;
+        uint8_t opponent = (color == Piece::White) ? Piece::Black : Piece::White;
+        for (int sq = 0; sq < 64; sq++) {
+            uint8_t p = board.pieceAt(sq / 8, sq % 8);
+            if (p == Piece::None) continue;
+            addRow(own.data(), &inputWeights[nnueFeature(p, sq, color) * NnueHidden]);
+            addRow(other.data(), &inputWeights[nnueFeature(p, sq, opponent) * NnueHidden]);
+        }
+        int32_t sum = dotClipped(own.data(), &outputWeights[0]) + dotClipped(other.data(), &outputWeights[NnueHidden]);
+        return (int)(((int64_t)sum + outputBias) * NnueScale / (NnueQA * NnueQB));
+    }
+
+private:
+    alignas(32) std::array<int16_t, NnueInputs * NnueHidden> inputWeights = {};
+    alignas(32) std::array<int16_t, NnueHidden> inputBias = {};
+    alignas(32) std::array<int16_t, 2 * NnueHidden> outputWeights = {};
+    int32_t outputBias = 0;
+
+    static void addRow(int16_t* acc, const int16_t* row) {
+#ifdef __AVX2__
+        for (int i = 0; i < NnueHidden; i += 16) {
+            __m256i a = _mm256_load_si256((const __m256i*)(acc + i));
+            _mm256_store_si256((__m256i*)(acc + i), _mm256_add_epi16(a, _mm256_load_si256((const __m256i*)(row + i))));
+        }
+#else
+        for (int i = 0; i < NnueHidden; i++) acc[i] += row[i];
+#endif
+    }
+
+    // Sum of clamp(acc, 0, QA) * weight
+    static int32_t dotClipped(const int16_t* acc, const int16_t* weights) {
+#ifdef __AVX2__
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i top = _mm256_set1_epi16(NnueQA);
+        __m256i sum = _mm256_setzero_si256();
+        for (int i = 0; i < NnueHidden; i += 16) {
+            __m256i a = _mm256_min_epi16(_mm256_max_epi16(_mm256_load_si256((const __m256i*)(acc + i)), zero), top);
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(a, _mm256_load_si256((const __m256i*)(weights + i))));
+        }
+        __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+        half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4E));
+        half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xB1));
+        return _mm_cvtsi128_si32(half);
+#else
+        int32_t sum = 0;
+        for (int i = 0; i < NnueHidden; i++) sum += std::clamp<int32_t>(acc[i], 0, NnueQA) * weights[i];
+        return sum;
+#endif
+    }
+};
+
+NnueNetwork nnue;
+
+// Single-threaded iterative deepening alpha-beta over a private copy of the board
+class Search {
+public:
+    bool verbose = false;
+    int multiPV = 1; // Number of best root moves to report, each line excludes the ones before it
+    uint64_t nodeLimit = 0; // Aborts past this many nodes and keeps the last full iteration, 0 for none
+    SearchParams params = searchParams;
+    PruneStats stats;
+    std::function<void(const SearchResult&)> onIteration; // Called after every completed depth
+
+    Search(const ChessBoard& position, bool isWhitesTurn, TranspositionTable& table = transpositionTable)
+        : board(position), rootColor(isWhitesTurn ? Piece::White : Piece::Black), tt(table) {
+        memoryHandle = memoryRegistry.add("Search tables", [this]() {
+            size_t bytes = sizeof(Search) + continuationHistory.size() * sizeof(int16_t);
+            return MemoryUsage{ bytes, bytes };
+        });
+    }
+
+    ~Search() { memoryRegistry.remove(memoryHandle); }
+
+    Search(const Search&) = delete;
+    Search& operator=(const Search&) = delete;
+
+    // Starts over on a new position as if freshly constructed, keeping the settings and the
+    // table allocations. Drivers that search one position after another reuse a single Search.
+    void reset(const ChessBoard& position, bool isWhitesTurn) {
+        board = position;
+        rootColor = isWhitesTurn ? Piece::White : Piece::Black;
+        nodes = 0;
+        stats = PruneStats();
+        excludedRootMoves.clear();
+        canStop = stopped = false;
+        extensionsOnPath.fill(0);
+        excludedMove.fill(Move());
+        pvLength.fill(0);
+        killers = {};
+        history = {};
+        std::fill(continuationHistory.begin(), continuationHistory.end(), 0);
+        counterMoves = {};
+        playedPieceTo.fill(0);
+    }
+
+    SearchResult run(int maxDepth) {
+        SearchResult result;
+        for (int depth = 1; depth <= maxDepth; depth++) {
+            trace(TraceEvent::IterationStart, depth);
+            std::vector<PVLine> lines;
+            excludedRootMoves.clear();
+            canStop = depth > 1; // Depth 1 always completes, so there is a move to return
+            for (int k = 0; k < multiPV; k++) {
+                int score = alphaBeta(rootColor, depth, -InfiniteScore, InfiniteScore, 0);
+                if (stopped || pvLength[0] == 0) break; // Out of nodes, or no root moves left (or none at all)
+
+                PVLine line;
+                line.score = score;
+                line.moves.assign(pvTable[0].begin(), pvTable[0].begin() + pvLength[0]);
+                excludedRootMoves.push_back(line.moves[0]);
+                lines.push_back(line);
+            }
+            trace(TraceEvent::IterationEnd, depth);
+            if (stopped) break; // The partial iteration is discarded
+
+            // Later lines can outscore earlier ones when the TT shifts, keep them ordered
+            std::stable_sort(lines.begin(), lines.end(), [](const PVLine& a, const PVLine& b) { return a.score > b.score; });
+
+            result.depth = depth;
+            result.lines = lines;
+            result.score = lines.empty() ? (board.isInCheck(rootColor) ? -MateScore : 0) : lines[0].score;
+            result.pv = lines.empty() ? std::vector<Move>() : lines[0].moves;
+            if (!result.pv.empty()) result.best = result.pv[0];
+
+            if (verbose) {
+                for (size_t k = 0; k < lines.size(); k++) {
+                    cout << "depth " << depth << " multipv " << k + 1 << " score " << lines[k].score << " nodes " << nodes << " pv";
+                    for (const Move& m : lines[k].moves) cout << ' ' << moveToString(m);
+                    cout << newline;
+                }
+            }
+            if (onIteration) {
+                result.nodes = nodes;
+                onIteration(result);
+            }
+        }
+        result.nodes = nodes;
+        return result;
+    }
+
+    // Searches only 'rootMoves' at the root, lets a driver split the root between searches.
+    // Returns the fail-soft score, 'pv' is filled when a move beats alpha.
+    int searchRootMoves(const std::vector<Move>& rootMoves, int depth, int alpha, int beta, std::vector<Move>& pv) {
+        std::vector<Move> all;
+        board.generateMoves(rootColor, all);
+        excludedRootMoves.clear();
+        for (const Move& m : all) {
+            bool wanted = false;
+            for (const Move& r : rootMoves) if (sameMove(m, r)) wanted = true;
+            if (!wanted) excludedRootMoves.push_back(m);
+        }
+        int score = alphaBeta(rootColor, depth, alpha, beta, 0);
+        excludedRootMoves.clear();
+        pv.assign(pvTable[0].begin(), pvTable[0].begin() + pvLength[0]);
+        return score;
+    }
+
+    // Quiescence score of 'position' for 'color', lets other searches use this one as a leaf evaluator
+    int quiescenceScore(const ChessBoard& position, uint8_t color) {
+        board = position;
+        return quiesce(color, -InfiniteScore, InfiniteScore, 0);
+    }
+
+    uint64_t nodes = 0;
+
+private:
+    ChessBoard board;
+    uint8_t rootColor;
+    TranspositionTable& tt;
+    std::vector<Move> excludedRootMoves;
+    int memoryHandle = 0;
+    bool canStop = false;
+    bool stopped = false;
+
+    // Extensions already granted on the path to each ply, and the TT move skipped by a singular test
+    std::array<int, MaxPly + 1> extensionsOnPath = { 0 };
+    std::array<Move, MaxPly> excludedMove = {};
+
+    // Triangular PV table
+    std::array<std::array<Move, MaxPly>, MaxPly> pvTable = {};
+    std::array<int, MaxPly> pvLength = { 0 };
+    std::array<std::array<Move, 2>, MaxPly> killers = {};
+
+    // Quiet move ordering. Tables are indexed by (piece, to-square) pairs, see pieceTo().
+    // The butterfly history is by from/to, the continuation history by the move played one
+    // or two plies earlier, and counterMoves holds the refutation of the previous move.
+    static constexpr int PieceToCount = 12 * 64;
+    static constexpr int MaxHistory = 16384;
+    std::array<std::array<int16_t, 64>, 64> history = {};
+    std::vector<int16_t> continuationHistory = std::vector<int16_t>(PieceToCount * PieceToCount, 0);
+    std::array<Move, PieceToCount> counterMoves = {};
+    std::array<int, MaxPly + 1> playedPieceTo = {}; // (piece, to) of the move made at each ply, set before it is searched
+
+    static int pieceTo(uint8_t piece, int to) {
+        return ((piece & typeMask) - 1 + ((piece & Piece::Black) ? 6 : 0)) * 64 + to;
+    }
+
+    int previousPieceTo(int ply, int pliesBack) const {
+        return (ply >= pliesBack) ? playedPieceTo[ply - pliesBack] : -1;
+    }
+
+    // Gravity update: the entry moves towards the bonus and saturates at +-MaxHistory
+    static void updateHistory(int16_t& entry, int bonus) {
+        entry += bonus - entry * std::abs(bonus) / MaxHistory;
+    }
+
+    int quietScore(const Move& m, int ply) const {
+        int current = pieceTo(board.pieceAt(m.from / 8, m.from % 8), m.to);
+        int score = history[m.from][m.to];
+        for (int back = 1; back <= 2; back++) {
+            int previous = previousPieceTo(ply, back);
+            if (previous >= 0) score += continuationHistory[previous * PieceToCount + current];
+        }
+        return score;
+    }
+
+    // Rewards the quiet move that caused a cutoff. Penalizing the quiets tried before it
+    // was measured too and cost nodes on the bench set, as nothing here is reduced by history yet.
+    void updateQuietStats(const Move& best, int depth, int ply) {
+        int bonus = std::min(16 * depth * depth, 1200);
+        updateHistory(history[best.from][best.to], bonus);
+        int current = pieceTo(board.pieceAt(best.from / 8, best.from % 8), best.to);
+        for (int back = 1; back <= 2; back++) {
+            int previous = previousPieceTo(ply, back);
+            if (previous >= 0) updateHistory(continuationHistory[previous * PieceToCount + current], bonus);
+        }
+
+        int previous = previousPieceTo(ply, 1);
+        if (previous >= 0) counterMoves[previous] = best;
+    }
+
+    // Material plus a small centralization / pawn advancement bonus, from White's side.
+    // A network loaded with '--nnue' replaces it.
+    int evaluate(uint8_t color) const {
+        if (nnue.loaded) return nnue.evaluate(board, color);
+        static const int center[8] = { 0, 2, 4, 6, 6, 4, 2, 0 };
+        int score = 0;
+        for (int r = 0; r < 8; r++) {
+            for (int c = 0; c < 8; c++) {
+                uint8_t p = board.pieceAt(r, c);
+                if (p == Piece::None) continue;
+                uint8_t type = p & typeMask;
+                int value = pieceValues[type];
+                if (type == Piece::Pawn) value += 5 * ((p & Piece::White) ? 6 - r : r - 1);
+                else if (type == Piece::Knight || type == Piece::Bishop) value += center[r] + center[c];
+                score += (p & Piece::White) ? value : -value;
+            }
+        }
+        return (color == Piece::White) ? score : -score;
+    }
+
+    uint64_t positionKey(uint8_t color) const {
+        return board.hashKey() ^ ((color == Piece::Black) ? zobrist.blackToMove : 0);
+    }
+
+    // Key of the position after 'm' is played by 'color'
+    uint64_t childKey(const Move& m, uint8_t color) const {
+        return board.hashAfter(m) ^ ((color == Piece::White) ? zobrist.blackToMove : 0);
+    }
+
+    // Mate scores are stored relative to the node so they stay valid at other plies
+    static int scoreToTT(int score, int ply) {
+        if (score > MateScore - MaxPly) return score + ply;
+        if (score < -MateScore + MaxPly) return score - ply;
+        return score;
+    }
+
+    static int scoreFromTT(int score, int ply) {
+        if (score > MateScore - MaxPly) return score - ply;
+        if (score < -MateScore + MaxPly) return score + ply;
+        return score;
+    }
+
+    // TT move first, MVV-LVA for captures, then killers, the counter-move, then history for quiet moves
+    void scoreMoves(const std::vector<Move>& moves, std::vector<int>& scores, int ply, const Move& ttMove = Move{}) const {
+        scores.resize(moves.size());
+        int previous = previousPieceTo(ply, 1);
+        Move counter = (previous >= 0) ? counterMoves[previous] : Move{};
+        for (size_t i = 0; i < moves.size(); i++) {
+            const Move& m = moves[i];
+            if (ttMove.from != ttMove.to && sameMove(m, ttMove)) scores[i] = 1 << 30;
+            else if (m.captured != Piece::None) {
+                uint8_t attacker = board.pieceAt(m.from / 8, m.from % 8) & typeMask;
+                scores[i] = (1 << 20) + pieceValues[m.captured & typeMask] * 8 - attacker;
+            }
+            else if (sameMove(m, killers[ply][0])) scores[i] = (1 << 19);
+            else if (sameMove(m, killers[ply][1])) scores[i] = (1 << 19) - 1;
+            else if (counter.from != counter.to && sameMove(m, counter)) scores[i] = (1 << 19) - 2;
+            else scores[i] = quietScore(m, ply);
+        }
+    }
+
+    // Selection sort step, moves the best remaining move to index i
+    static void pickMove(std::vector<Move>& moves, std::vector<int>& scores, size_t i) {
+        size_t best = i;
+        for (size_t j = i + 1; j < moves.size(); j++) if (scores[j] > scores[best]) best = j;
+        std::swap(moves[i], moves[best]);
+        std::swap(scores[i], scores[best]);
+    }
+
+    // Once the node limit is hit every node returns at once, callers check 'stopped' before using a score
+    bool outOfNodes() {
+        if (canStop && nodeLimit && nodes >= nodeLimit) stopped = true;
+        return stopped;
+    }
+
+    int quiesce(uint8_t color, int alpha, int beta, int ply) {
+        if (outOfNodes()) return 0;
+        nodes++;
+        int standPat = evaluate(color);
+        if (standPat >= beta || ply >= MaxPly - 1) return standPat;
+        if (standPat > alpha) alpha = standPat;
+        int bestScore = standPat;
+
+        std::vector<Move> moves;
+        board.generateMoves(color, moves);
+        std::vector<Move> captures;
+        for (const Move& m : moves) if (m.captured != Piece::None) captures.push_back(m);
+
+        std::vector<int> scores;
+        scoreMoves(captures, scores, ply);
+        for (size_t i = 0; i < captures.size(); i++) {
+            pickMove(captures, scores, i);
+            if (params.pruning && board.see(captures[i]) < 0) { stats.seeQuiescence++; continue; }
+            board.doMove(captures[i]);
+            int score = -quiesce(opposite(color), -beta, -alpha, ply + 1);
+            board.undoMove(captures[i]);
+
+            if (score >= beta) return score;
+            if (score > bestScore) bestScore = score;
+            if (score > alpha) alpha = score;
+        }
+        return bestScore; // Fail-soft, razoring needs to know how far below alpha this is
+    }
+
+    bool isExcludedRootMove(const Move& m, int ply) const {
+        if (ply != 0) return false;
+        for (const Move& e : excludedRootMoves) if (sameMove(m, e)) return true;
+        return false;
+    }
+
+    int alphaBeta(uint8_t color, int depth, int alpha, int beta, int ply) {
+        pvLength[ply] = 0;
+        if (depth <= 0 || ply >= MaxPly - 1) return quiesce(color, alpha, beta, ply);
+        if (outOfNodes()) return 0;
+        nodes++;
+        if (ply == 0) extensionsOnPath[0] = 0;
+
+        // The root is never cut, and its TT entry is skipped while MultiPV excludes moves.
+        // A singular test searches this same position without the TT move, so it neither cuts nor stores.
+        const Move excluded = excludedMove[ply];
+        bool excluding = excluded.from != excluded.to;
+        uint64_t key = positionKey(color);
+        TTEntry entry;
+        Move ttMove;
+        bool ttHit = tt.probe(key, entry);
+        int ttScore = ttHit ? scoreFromTT(entry.score, ply) : 0;
+        if (ttHit) {
+            ttMove = { entry.from, entry.to, Piece::None };
+            if (ply > 0 && !excluding && entry.depth >= depth) {
+                if (entry.bound == Bound::Exact) return ttScore;
+                if (entry.bound == Bound::Lower && ttScore >= beta) return ttScore;
+                if (entry.bound == Bound::Upper && ttScore <= alpha) return ttScore;
+            }
+        }
+
+        bool inCheck = board.isInCheck(color);
+        int staticEval = inCheck ? -InfiniteScore : evaluate(color);
+        bool canPrune = params.pruning && ply > 0 && !inCheck && std::abs(beta) < MateScore - MaxPly;
+        bool shallow = depth <= params.maxPruneDepth;
+
+        // Reverse futility: one move rarely gives back this much, so assume the cutoff
+        if (canPrune && shallow && staticEval - params.reverseFutilityMargin * depth >= beta) {
+            stats.reverseFutility++;
+            return staticEval;
+        }
+
+        // Razoring: hopelessly below alpha, let quiescence confirm it
+        if (canPrune && depth <= 2 && staticEval + params.razorMargin * depth < alpha) {
+            int score = quiesce(color, alpha, beta, ply);
+            if (stopped) return 0;
+            if (score < alpha) {
+                stats.razoring++;
+                return score;
+            }
+        }
+
+        // Quiet moves that do not check cannot lift the eval above alpha
+        int futilityValue = staticEval + params.futilityMargin * depth;
+        bool futile = canPrune && shallow && futilityValue <= alpha;
+
+        std::vector<Move> moves;
+        moves.reserve(64);
+        board.generateMoves(color, moves);
+        if (moves.empty()) return inCheck ? -MateScore + ply : 0;
+
+        // ProbCut: a good capture that beats beta by a margin in a much shallower search
+        // almost certainly beats beta at full depth too. Skipped when the TT already says it won't.
+        int probBeta = beta + params.probCutMargin;
+        if (params.probCut && ply > 0 && !inCheck && !excluding && depth >= params.probCutMinDepth
+            && std::abs(beta) < MateScore - MaxPly
+            && !(ttHit && entry.depth >= depth - 3 && ttScore < probBeta)) {
+            for (const Move& m : moves) {
+                if (m.captured == Piece::None || board.see(m) < probBeta - staticEval) continue;
+                stats.probCutTries++;
+
+                extensionsOnPath[ply + 1] = extensionsOnPath[ply];
+                playedPieceTo[ply] = pieceTo(board.pieceAt(m.from / 8, m.from % 8), m.to);
+                board.doMove(m);
+                // Quiescence first, it is cheap and rejects most candidates
+                int score = -quiesce(opposite(color), -probBeta, -probBeta + 1, ply + 1);
+                if (score >= probBeta) score = -alphaBeta(opposite(color), depth - 4, -probBeta, -probBeta + 1, ply + 1);
+                board.undoMove(m);
+                if (stopped) return 0;
+
+                if (score >= probBeta) {
+                    stats.probCutCuts++;
+                    tt.store(key, depth - 3, scoreToTT(score, ply), Bound::Lower, m, true);
+                    return score;
+                }
+            }
+        }
+
+        std::vector<int> scores;
+        scoreMoves(moves, scores, ply, ttMove);
+
+        // Singular extension: if every other move fails well below the TT score in a reduced
+        // search, the TT move is the only good one and gets searched a ply deeper
+        bool ttMoveSingular = false;
+        bool canExtend = extensionsOnPath[ply] < params.maxExtensions;
+        if (params.singularExtensions && canExtend && ply > 0 && !excluding && ttHit
+            && depth >= params.singularMinDepth && ttMove.from != ttMove.to
+            && entry.depth >= depth - 3 && entry.bound != Bound::Upper
+            && std::abs(ttScore) < MateScore - MaxPly) {
+            int singularBeta = ttScore - params.singularMargin * depth;
+            stats.singularTests++;
+            // The test runs at this ply, so this node's PV and killer slots are put back afterwards
+            std::array<Move, 2> savedKillers = killers[ply];
+            excludedMove[ply] = ttMove;
+            int score = alphaBeta(color, (depth - 1) / 2, singularBeta - 1, singularBeta, ply);
+            excludedMove[ply] = Move{};
+            killers[ply] = savedKillers;
+            pvLength[ply] = 0;
+            if (stopped) return 0;
+            if (score < singularBeta) {
+                ttMoveSingular = true;
+                stats.singularExtensions++;
+            }
+        }
+
+        int originalAlpha = alpha;
+        int bestScore = -InfiniteScore;
+        Move bestMove;
+        for (size_t i = 0; i < moves.size(); i++) {
+            pickMove(moves, scores, i);
+            const Move& m = moves[i];
+            if (isExcludedRootMove(m, ply)) continue;
+            if (excluding && sameMove(m, excluded)) continue;
+
+            // The child probes its bucket first thing, the pruning and extension work below hides the miss
+            if (futile && m.captured == Piece::None && !board.givesCheck(m)) {
+                stats.futility++;
+                bestScore = std::max(bestScore, futilityValue);
+                continue;
+            }
+            // Losing captures, once at least one move has been searched
+            if (canPrune && shallow && m.captured != Piece::None && bestScore > -InfiniteScore
+                && board.see(m) < -params.seeMargin * depth) {
+                stats.see++;
+                continue;
+            }
+
+            int extension = 0;
+            if (canExtend) {
+                if (ttMoveSingular && sameMove(m, ttMove)) extension = 1;
+                else if (params.checkExtensions && board.givesCheck(m)) {
+                    extension = 1;
+                    stats.checkExtensions++;
+                }
+            }
+            extensionsOnPath[ply + 1] = extensionsOnPath[ply] + extension;
+            // Children at depth 0 go straight to quiescence, which never probes the TT
+            if (depth - 1 + extension > 0) tt.prefetch(childKey(m, color));
+
+            playedPieceTo[ply] = pieceTo(board.pieceAt(m.from / 8, m.from % 8), m.to);
+            board.doMove(m);
+            int score = -alphaBeta(opposite(color), depth - 1 + extension, -beta, -alpha, ply + 1);
+            board.undoMove(m);
+            if (stopped) return 0;
+
+            if (score > bestScore) { bestScore = score; bestMove = m; }
+            if (score > alpha) {
+                alpha = score;
+                pvTable[ply][0] = m;
+                for (int j = 0; j < pvLength[ply + 1]; j++) pvTable[ply][j + 1] = pvTable[ply + 1][j];
+                pvLength[ply] = pvLength[ply + 1] + 1;
+            }
+            if (alpha >= beta) {
+                if (m.captured == Piece::None) {
+                    if (!sameMove(m, killers[ply][0])) {
+                        killers[ply][1] = killers[ply][0];
+                        killers[ply][0] = m;
+                    }
+                    updateQuietStats(m, depth, ply);
+                }
+                break;
+            }
+        }
+
+        // Every root move was excluded, there is no further line to report
+        if (ply == 0 && bestScore == -InfiniteScore) return bestScore;
+
+        if ((ply > 0 && !excluding) || (ply == 0 && excludedRootMoves.empty())) {
+            Bound bound = (bestScore >= beta) ? Bound::Lower : (alpha > originalAlpha) ? Bound::Exact : Bound::Upper;
+            tt.store(key, depth, scoreToTT(bestScore, ply), bound, bestMove);
+        }
+        return bestScore;
+    }
+};
+
+// --- Deterministic Parallel Search ---
+// Root splitting with a fixed partition, for benchmarks that must repeat exactly. Each iteration
+// searches the first root move alone to set alpha, then helper t takes moves t, t + N, ... of the
+// rest. Helpers read the shared TT but store into private overlays, which are merged in helper
+// order once all of them have finished. Nothing depends on thread timing, so a given thread
+// count always gives the same nodes and moves. The cost: helpers never see each other's entries
+// or a raised alpha within an iteration, so they search more nodes than one thread would.
+
+class DeterministicSearch {
+public:
+    DeterministicSearch(const ChessBoard& position, bool isWhitesTurn, int threads, TranspositionTable& table = transpositionTable)
+        : board(position), rootColor(isWhitesTurn ? Piece::White : Piece::Black), tt(table), master(position, isWhitesTurn, table) {
+        size_t overlayMB = std::max<size_t>(1, (table.sizeBytes() >> 20) / std::max(1, threads));
+        for (int t = 0; t < std::max(1, threads); t++) {
+            overlays.push_back(std::make_unique<TranspositionTable>());
+            overlays.back()->resize(overlayMB);
+            overlays.back()->setBase(&table);
+            helpers.push_back(std::make_unique<Search>(position, isWhitesTurn, *overlays.back()));
+        }
+    }
+
+    SearchResult run(int maxDepth) {
+        SearchResult result;
+        std::vector<Move> rootMoves;
+        board.generateMoves(rootColor, rootMoves);
+        if (rootMoves.empty()) {
+            result.score = board.isInCheck(rootColor) ? -MateScore : 0;
+            return result;
+        }
+
+        for (int depth = 1; depth <= maxDepth; depth++) {
+            trace(TraceEvent::IterationStart, depth);
+            // Last iteration's best move first, the rest keep generation order
+            for (size_t i = 0; i < rootMoves.size(); i++) {
+                if (sameMove(rootMoves[i], result.best)) std::rotate(rootMoves.begin(), rootMoves.begin() + i, rootMoves.begin() + i + 1);
+            }
+
+            std::vector<Move> pv;
+            int alpha = master.searchRootMoves({ rootMoves[0] }, depth, -InfiniteScore, InfiniteScore, pv);
+            int bestScore = alpha;
+            std::vector<Move> bestPv = pv;
+
+            size_t threads = helpers.size();
+            std::vector<int> scores(threads, -InfiniteScore);
+            std::vector<std::vector<Move>> pvs(threads);
+            std::vector<std::thread> workers;
+            for (size_t t = 0; t < threads; t++) {
+                std::vector<Move> share;
+                for (size_t j = 1 + t; j < rootMoves.size(); j += threads) share.push_back(rootMoves[j]);
+                if (share.empty()) continue;
+                workers.emplace_back([this, t, share, depth, alpha, &scores, &pvs]() {
+                    scores[t] = helpers[t]->searchRootMoves(share, depth, alpha, InfiniteScore, pvs[t]);
+                });
+            }
+            for (std::thread& w : workers) w.join();
+
+            // Ties go to the lower helper, the merge order is fixed the same way
+            for (size_t t = 0; t < threads; t++) {
+                if (scores[t] > bestScore) { bestScore = scores[t]; bestPv = pvs[t]; }
+                overlays[t]->mergeInto(tt);
+                overlays[t]->clear();
+            }
+            trace(TraceEvent::IterationEnd, depth);
+
+            result.depth = depth;
+            result.score = bestScore;
+            result.pv = bestPv;
+            if (!bestPv.empty()) result.best = bestPv[0];
+        }
+        result.nodes = nodes();
+        return result;
+    }
+
+    uint64_t nodes() const {
+        uint64_t total = master.nodes;
+        for (const auto& h : helpers) total += h->nodes;
+        return total;
+    }
+
+    PruneStats stats() const {
+        PruneStats total = master.stats;
+        for (const auto& h : helpers) total.add(h->stats);
+        return total;
+    }
+
+private:
+    ChessBoard board;
+    uint8_t rootColor;
+    TranspositionTable& tt;
+    Search master;
+    std::vector<std::unique_ptr<TranspositionTable>> overlays;
+    std::vector<std::unique_ptr<Search>> helpers;
+};
+
+// --- Proof-Number Search ---
+// Depth-first proof-number search (df-pn) for "mate in N". Numbers are kept in phi/delta form:
+// phi is the proof number for the side to move, delta its disproof number. Only the attacker
+// can win, the defender "wins" by surviving N attacker moves or by being stalemated.
+
+constexpr uint32_t PnInfinity = 1u << 30;
+
+struct PnEntry {
+    uint64_t key = 0;
+    uint32_t phi = 0;
+    uint32_t delta = 0;
+    uint32_t work = 0; // Nodes spent below this entry, eviction keeps the expensive ones
+    uint32_t used = 0;
+};
+
+// Bounded table of proof and disproof numbers. A full bucket replaces its cheapest entry, and once
+// the table is three quarters full a collection pass drops the half of the entries with the least work.
+class PnTable {
+public:
+    explicit PnTable(size_t megabytes) {
+        size_t buckets = 1;
+        while (buckets * 2 * BucketSize * sizeof(PnEntry) <= megabytes * 1024 * 1024) buckets *= 2;
+        entries.assign(buckets * BucketSize, PnEntry{});
+        mask = buckets - 1;
+        memoryHandle = memoryRegistry.add("Proof-number table", [this]() {
+            size_t bytes = entries.size() * sizeof(PnEntry);
+            return MemoryUsage{ bytes, bytes };
+        });
+    }
+
+    ~PnTable() { memoryRegistry.remove(memoryHandle); }
+
+    PnTable(const PnTable&) = delete;
+    PnTable& operator=(const PnTable&) = delete;
+
+    bool lookup(uint64_t key, uint32_t& phi, uint32_t& delta) const {
+        const PnEntry* bucket = &entries[(key & mask) * BucketSize];
+        for (size_t i = 0; i < BucketSize; i++) {
+            if (bucket[i].used && bucket[i].key == key) {
+                phi = bucket[i].phi;
+                delta = bucket[i].delta;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    uint32_t workOf(uint64_t key) const {
+        const PnEntry* bucket = &entries[(key & mask) * BucketSize];
+        for (size_t i = 0; i < BucketSize; i++) if (bucket[i].used && bucket[i].key == key) return bucket[i].work;
+        return 0;
+    }
+
+    void store(uint64_t key, uint32_t phi, uint32_t delta, uint64_t work) {
+        PnEntry* bucket = &entries[(key & mask) * BucketSize];
+        PnEntry* target = nullptr;
+        for (size_t i = 0; i < BucketSize && !target; i++) if (bucket[i].used && bucket[i].key == key) target = &bucket[i];
+        for (size_t i = 0; i < BucketSize && !target; i++) if (!bucket[i].used) target = &bucket[i];
+        if (!target) {
+            target = &bucket[0];
+            for (size_t i = 1; i < BucketSize; i++) if (bucket[i].work < target->work) target = &bucket[i];
+        }
+        if (!target->used) count++;
+        *target = { key, phi, delta, (uint32_t)std::min<uint64_t>(work, UINT32_MAX), 1 };
+        if (count > entries.size() / 4 * 3) collect();
+    }
+
+    size_t size() const { return count; }
+    int collections = 0;
+
+private:
+    static constexpr size_t BucketSize = 4;
+    std::vector<PnEntry> entries;
+    size_t mask = 0;
+    size_t count = 0;
+    int memoryHandle = 0;
+
+    // Frees the cheapest half of the table, anything below it is quick to rebuild
+    void collect() {
+        std::vector<uint32_t> works;
+        works.reserve(count);
+        for (const PnEntry& e : entries) if (e.used) works.push_back(e.work);
+        size_t drop = works.size() / 2;
+        std::nth_element(works.begin(), works.begin() + drop, works.end());
+        uint32_t cutoff = works[drop];
+
+        for (PnEntry& e : entries) {
+            if (drop == 0) break;
+            if (e.used && e.work < cutoff) { e.used = 0; count--; drop--; }
+        }
+        for (PnEntry& e : entries) {
+            if (drop == 0) break;
+            if (e.used && e.work == cutoff) { e.used = 0; count--; drop--; }
+        }
+        collections++;
+    }
+};
+
+class ProofNumberSearch {
+public:
+    uint64_t nodes = 0;
+    uint64_t maxNodes = 50000000;
+
+    ProofNumberSearch(const ChessBoard& position, bool isWhitesTurn, size_t tableMB)
+        : board(position), attackerColor(isWhitesTurn ? Piece::White : Piece::Black), table(tableMB) {}
+
+    // Returns 1 if a mate in 'moves' is proven, 0 if disproven, -1 if the node budget ran out
+    int solve(int moves) {
+        rootPlies = 2 * moves - 1;
+        uint32_t phi = 0, delta = 0;
+        mid(attackerColor, rootPlies, PnInfinity - 1, PnInfinity - 1, phi, delta);
+        if (phi == 0) return 1;
+        if (delta == 0) return 0;
+        return -1;
+    }
+
+    // Follows proven children: a mating move for the attacker, the most expensive defense for the defender
+    std::vector<Move> principalVariation() {
+        std::vector<Move> line;
+        uint8_t color = attackerColor;
+        for (int plies = rootPlies; plies > 0; plies--) {
+            std::vector<Move> moves;
+            board.generateMoves(color, moves);
+            bool attacker = color == attackerColor;
+            const Move* chosen = nullptr;
+            uint32_t bestWork = 0;
+            for (const Move& m : moves) {
+                uint32_t phi, delta;
+                uint64_t key = childKey(m, color, plies);
+                if (!table.lookup(key, phi, delta)) continue;
+                if (attacker && delta == 0) { chosen = &m; break; }
+                if (!attacker && phi == 0 && (!chosen || table.workOf(key) >= bestWork)) {
+                    chosen = &m;
+                    bestWork = table.workOf(key);
+                }
+            }
+            if (!chosen) break;
+            line.push_back(*chosen);
+            board.doMove(*chosen);
+            color = opposite(color);
+        }
+        for (auto it = line.rbegin(); it != line.rend(); ++it) board.undoMove(*it);
+        return line;
+    }
+
+    size_t tableEntries() const { return table.size(); }
+    int collections() const { return table.collections; }
+
+private:
+    ChessBoard board;
+    uint8_t attackerColor;
+    PnTable table;
+    int rootPlies = 1;
+
+    // Remaining plies are part of the key, the same placement with fewer moves left is a different problem
+    static uint64_t nodeKey(uint64_t placement, uint8_t color, int plies) {
+        return placement ^ ((color == Piece::Black) ? zobrist.blackToMove : 0) ^ ((uint64_t)plies * 0x9E3779B97F4A7C15ull);
+    }
+
+    uint64_t childKey(const Move& m, uint8_t color, int plies) const {
+        return nodeKey(board.hashAfter(m), opposite(color), plies - 1);
+    }
+
+    static uint32_t saturate(uint64_t v) { return (uint32_t)std::min<uint64_t>(v, PnInfinity); }
+
+    // Leaves have fixed numbers, any other node is expanded until it crosses a threshold
+    void mid(uint8_t color, int plies, uint32_t thPhi, uint32_t thDelta, uint32_t& phi, uint32_t& delta) {
+        nodes++;
+        uint64_t key = nodeKey(board.hashKey(), color, plies);
+        bool attacker = color == attackerColor;
+
+        // The attacker always has plies left, so the defender survives once they run out unmated
+        std::vector<Move> moves;
+        board.generateMoves(color, moves);
+        bool stalemated = moves.empty() && !board.isInCheck(color);
+        if (!attacker && (stalemated || (plies <= 0 && !moves.empty()))) {
+            phi = 0; delta = PnInfinity;
+            table.store(key, phi, delta, 1);
+            return;
+        }
+        if (moves.empty()) {
+            phi = PnInfinity; delta = 0;
+            table.store(key, phi, delta, 1);
+            return;
+        }
+
+        uint64_t startNodes = nodes;
+        while (true) {
+            // phi is the smallest child delta, delta the sum of the child phis
+            uint32_t minDelta = PnInfinity, secondDelta = PnInfinity, bestPhi = 0;
+            uint64_t sumPhi = 0;
+            size_t best = 0;
+            for (size_t i = 0; i < moves.size(); i++) {
+                uint32_t childPhi = 1, childDelta = 1;
+                table.lookup(childKey(moves[i], color, plies), childPhi, childDelta);
+                sumPhi += childPhi;
+                if (childDelta < minDelta) {
+                    secondDelta = minDelta;
+                    minDelta = childDelta;
+                    bestPhi = childPhi;
+                    best = i;
+                }
+                else if (childDelta < secondDelta) secondDelta = childDelta;
+            }
+            phi = minDelta;
+            delta = saturate(sumPhi);
+            if (phi >= thPhi || delta >= thDelta || nodes >= maxNodes) break;
+
+            uint32_t childThPhi = saturate((uint64_t)thDelta + bestPhi - delta);
+            uint32_t childThDelta = std::min<uint32_t>(thPhi, secondDelta + 1);
+            uint32_t childPhi, childDelta;
+            board.doMove(moves[best]);
+            mid(opposite(color), plies - 1, childThPhi, childThDelta, childPhi, childDelta);
+            board.undoMove(moves[best]);
+        }
+        table.store(key, phi, delta, nodes - startNodes);
+    }
+};
+
+// Mate-in-N positions for timing the prover, all shortest mates under this game's rules
+struct MateProblem {
+    const char* fen;
+    int moves;
+};
+
+const MateProblem mateSuite[] = {
+    { "r1bqkb1r/pppp1ppp/2n2n2/4p2Q/2B1P3/8/PPPP1PPP/RNB1K1NR w", 1 },
+    { "6k1/5ppp/8/8/8/8/5PPP/3R2K1 w", 1 },
+    { "6rk/6pp/8/6N1/8/8/8/6K1 w", 1 },
+    { "k7/8/8/8/8/8/1R6/1R4K1 w", 1 },
+    { "k7/8/2K5/8/8/8/8/7R w", 2 },
+    { "7k/8/8/5K2/6Q1/8/8/8 w", 2 },
+    { "2k5/8/2K5/8/8/8/8/3R4 w", 2 },
+    { "7k/8/8/8/8/8/R7/1R4K1 w", 2 },
+    { "k7/8/8/3K4/8/8/8/7R w", 3 },
+    { "7k/8/8/8/4K3/6Q1/8/8 w", 3 },
+};
+
+constexpr size_t defaultPnTableMB = 32;
+
+// Proves one problem and prints the line, returns the result from ProofNumberSearch::solve
+int proveMate(const char* fen, int moves, bool verbose) {
+    ChessBoard game;
+    bool isWhitesTurn = true;
+    if (!game.loadFen(fen, isWhitesTurn)) {
+        cout << "Invalid FEN: " << fen << newline;
+        return -1;
+    }
+
+    ProofNumberSearch pns(game, isWhitesTurn, defaultPnTableMB);
+    auto start = std::chrono::steady_clock::now();
+    int result = pns.solve(moves);
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+    cout << (result == 1 ? "Mate in " : result == 0 ? "No mate in " : "Unresolved mate in ") << moves << ": ";
+    if (result == 1) for (const Move& m : pns.principalVariation()) cout << moveToString(m) << ' ';
+    cout << " (" << pns.nodes << " nodes, " << us / 1000.0 << " ms";
+    if (verbose) cout << ", " << pns.tableEntries() << " entries, " << pns.collections() << " collections";
+    cout << ")" << newline;
+    return result;
+}
+
+// Usage: chess mate <N> [fen]   or   chess mate suite
+int runMate(int argc, char* argv[]) {
+    if (argc > 2 && std::string(argv[2]) == "suite") {
+        int solved = 0, total = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (const MateProblem& problem : mateSuite) {
+            cout << problem.fen << "  ";
+            solved += proveMate(problem.fen, problem.moves, false) == 1;
+            total++;
+        }
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+        cout << "\nProven: " << solved << " / " << total << " in " << ms << " ms" << newline;
+        return solved == total ? 0 : 1;
+    }
+
+    int moves = (argc > 2) ? std::max(1, std::atoi(argv[2])) : 1;
+    std::string fen;
+    for (int i = 3; i < argc; i++) fen += (fen.empty() ? "" : " ") + std::string(argv[i]);
+    if (fen.empty()) fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w";
+    return proveMate(fen.c_str(), moves, true) == 1 ? 0 : 1;
+}
+
+// --- Monte Carlo Tree Search ---
+// PUCT selection over a tree allocated from a fixed arena. Threads descend the same tree at once,
+// and virtual loss steers them apart. Leaves are scored by the alpha-beta quiescence search.
+
+struct MctsNode {
+    std::atomic<int32_t> visits{ 0 };
+    std::atomic<int32_t> virtualLoss{ 0 };
+    std::atomic<int64_t> valueSum{ 0 };     // Milli-units, from the view of the side that moved into this node
+    std::atomic<uint8_t> state{ 0 };        // Unexpanded, Expanding, Expanded
+    uint16_t childCount = 0;
+    Move move;
+    float prior = 0.0f;
+    MctsNode* children = nullptr;
+
+    static constexpr uint8_t Unexpanded = 0, Expanding = 1, Expanded = 2;
+};
+
+// Bump allocator, nodes are never freed individually (the whole tree goes with the arena)
+class MctsArena {
+public:
+    explicit MctsArena(size_t megabytes) : nodes(megabytes * 1024 * 1024 / sizeof(MctsNode)) {
+        memoryHandle = memoryRegistry.add("MCTS arena", [this]() {
+            return MemoryUsage{ nodes.size() * sizeof(MctsNode), std::min(used.load(), nodes.size()) * sizeof(MctsNode) };
+        });
+    }
+
+    ~MctsArena() { memoryRegistry.remove(memoryHandle); }
+
+    MctsArena(const MctsArena&) = delete;
+    MctsArena& operator=(const MctsArena&) = delete;
+
+    // Returns nullptr once the arena is exhausted, the tree then simply stops growing
+    MctsNode* allocate(size_t count) {
+        size_t start = used.fetch_add(count, std::memory_order_relaxed);
+        if (start + count > nodes.size()) return nullptr;
+        return &nodes[start];
+    }
+
+    size_t allocated() const { return std::min(used.load(), nodes.size()); }
+
+private:
+    std::vector<MctsNode> nodes;
+    std::atomic<size_t> used{ 0 };
+    int memoryHandle = 0;
+};
+
+constexpr size_t defaultMctsArenaMB = 64;
+
+class MonteCarloSearch {
+public:
+    double exploration = 1.5;
+    int virtualLossWeight = 3;
+
+    MonteCarloSearch(const ChessBoard& position, bool isWhitesTurn, size_t arenaMB = defaultMctsArenaMB)
+        : rootBoard(position), rootColor(isWhitesTurn ? Piece::White : Piece::Black), arena(arenaMB) {}
+
+    // Runs until 'playouts' have completed across all threads
+    void run(int playouts, int threads) {
+        remaining = playouts;
+        std::vector<std::thread> workers;
+        for (int t = 1; t < threads; t++) workers.emplace_back([this]() { worker(); });
+        worker();
+        for (std::thread& w : workers) w.join();
+    }
+
+    // Most visited root move
+    const MctsNode* bestChild() const {
+        const MctsNode* best = nullptr;
+        for (int i = 0; i < root->childCount; i++) {
+            const MctsNode* child = &root->children[i];
+            if (!best || child->visits > best->visits) best = child;
+        }
+        return best;
+    }
+
+    int completedPlayouts() const { return root->visits; }
+    size_t treeNodes() const { return arena.allocated(); }
+
+private:
+    ChessBoard rootBoard;
+    uint8_t rootColor;
+    MctsArena arena;
+    MctsNode rootNode;
+    MctsNode* root = &rootNode;
+    std::atomic<int> remaining{ 0 };
+
+    void worker() {
+        Search evaluator(rootBoard, rootColor == Piece::White);
+        evaluator.params.pruning = false; // Quiescence only, but keep it exact
+        while (remaining.fetch_sub(1, std::memory_order_relaxed) > 0) playout(evaluator);
+    }
+
+    // Q + U, seen from the side to move at 'parent'. Virtual loss counts as lost visits.
+    MctsNode* selectChild(MctsNode* parent) const {
+        double parentVisits = parent->visits.load(std::memory_order_relaxed) + parent->virtualLoss.load(std::memory_order_relaxed);
+        double sqrtParent = std::sqrt(parentVisits + 1);
+        MctsNode* best = &parent->children[0];
+        double bestScore = -1e9;
+        for (int i = 0; i < parent->childCount; i++) {
+            MctsNode* child = &parent->children[i];
+            int loss = child->virtualLoss.load(std::memory_order_relaxed) * virtualLossWeight;
+            double n = child->visits.load(std::memory_order_relaxed) + loss;
+            double q = (n > 0) ? (child->valueSum.load(std::memory_order_relaxed) / 1000.0 - loss) / n : 0.0;
+            double score = q + exploration * child->prior * sqrtParent / (1 + n);
+            if (score > bestScore) { bestScore = score; best = child; }
+        }
+        return best;
+    }
+
+    // Priors favor captures of valuable pieces, everything else is uniform
+    void expand(MctsNode* node, const std::vector<Move>& moves) {
+        uint8_t expected = MctsNode::Unexpanded;
+        if (!node->state.compare_exchange_strong(expected, MctsNode::Expanding)) return;
+
+        MctsNode* children = arena.allocate(moves.size());
+        if (!children) {
+            node->state = MctsNode::Unexpanded; // Arena full, stays a leaf
+            return;
+        }
+        double total = 0;
+        for (const Move& m : moves) total += 1.0 + pieceValues[m.captured & typeMask] / 100.0;
+        for (size_t i = 0; i < moves.size(); i++) {
+            children[i].move = moves[i];
+            children[i].prior = (float)((1.0 + pieceValues[moves[i].captured & typeMask] / 100.0) / total);
+        }
+        node->children = children;
+        node->childCount = (uint16_t)moves.size();
+        node->state.store(MctsNode::Expanded, std::memory_order_release);
+    }
+
+    void playout(Search& evaluator) {
+        ChessBoard board = rootBoard;
+        uint8_t color = rootColor;
+        MctsNode* path[MaxPly * 4];
+        int length = 0;
+        MctsNode* node = root;
+        path[length++] = node;
+        node->virtualLoss++;
+
+        while (node->state.load(std::memory_order_acquire) == MctsNode::Expanded && node->childCount > 0
+            && length < MaxPly * 4) {
+            node = selectChild(node);
+            node->virtualLoss++;
+            board.doMove(node->move);
+            color = opposite(color);
+            path[length++] = node;
+        }
+
+        // Value for the side to move at the leaf, in [-1, 1]
+        double value;
+        std::vector<Move> moves;
+        board.generateMoves(color, moves);
+        if (moves.empty()) value = board.isInCheck(color) ? -1.0 : 0.0;
+        else {
+            expand(node, moves);
+            value = std::tanh(evaluator.quiescenceScore(board, color) / 400.0);
+        }
+
+        // Each node stores the result for the side that moved into it
+        for (int i = length - 1; i >= 0; i--) {
+            value = -value;
+            path[i]->valueSum.fetch_add((int64_t)(value * 1000), std::memory_order_relaxed);
+            path[i]->visits.fetch_add(1, std::memory_order_relaxed);
+            path[i]->virtualLoss--;
+        }
+    }
+};
+
+// Usage: chess mcts [playouts] [threads|scale] [fen]
+// 'scale' repeats the search with 1, 2, 4 ... threads up to the hardware count
+int runMcts(int argc, char* argv[]) {
+    int playouts = (argc > 2) ? std::max(1, std::atoi(argv[2])) : 20000;
+    std::string threadArg = (argc > 3) ? argv[3] : "1";
+    std::string fen;
+    for (int i = 4; i < argc; i++) fen += (fen.empty() ? "" : " ") + std::string(argv[i]);
+
+    ChessBoard game;
+    bool isWhitesTurn = true;
+    if (!fen.empty() && !game.loadFen(fen, isWhitesTurn)) {
+        cout << "Invalid FEN: " << fen << newline;
+        return 1;
+    }
+
+    std::vector<int> threadCounts;
+    if (threadArg == "scale") {
+        int hardware = std::max(1u, std::thread::hardware_concurrency());
+        for (int t = 1; t <= hardware; t *= 2) threadCounts.push_back(t);
+    }
+    else threadCounts.push_back(std::max(1, std::atoi(threadArg.c_str())));
+
+    for (int threads : threadCounts) {
+        MonteCarloSearch mcts(game, isWhitesTurn);
+        auto start = std::chrono::steady_clock::now();
+        mcts.run(playouts, threads);
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+        const MctsNode* best = mcts.bestChild();
+        cout << "Threads " << threads << ": ";
+        if (best) {
+            cout << "best " << moveToString(best->move) << " (" << best->visits << " visits, Q "
+                << best->valueSum / 1000.0 / std::max(1, best->visits.load()) << "), ";
+        }
+        cout << mcts.completedPlayouts() << " playouts in " << ms << " ms, "
+            << (uint64_t)mcts.completedPlayouts() * 1000 / (ms + 1) << " playouts/s, "
+            << mcts.treeNodes() << " tree nodes" << newline;
+    }
+    return 0;
+}
+
+// Hardware counters read around a measured region through perf_event_open (Linux only)
+class PerfCounters {
+public:
+    enum Counter { Cycles, Instructions, CacheMisses, BranchMisses, CounterCount };
+
+    ~PerfCounters() {
+#ifdef __linux__
+        for (int fd : fds) if (fd >= 0) close(fd);
+#endif
+    }
+
+    // Returns false if no counter could be opened (not Linux, or perf_event_paranoid too strict)
+    bool open() {
+#ifdef __linux__
+        const uint64_t configs[CounterCount] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+        };
+        bool any = false;
+        for (int i = 0; i < CounterCount; i++) {
+            perf_event_attr attr{};
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof(attr);
+            attr.config = configs[i];
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+            any |= fds[i] >= 0;
+        }
+        return any;
+#else
+        return false;
+#endif
+    }
+
+    void start() {
+#ifdef __linux__
+        for (int fd : fds) {
+            if (fd < 0) continue;
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    // Excludes setup work between measured sections without resetting the totals
+    void pause() {
+#ifdef __linux__
+        for (int fd : fds) if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+#endif
+    }
+
+    void resume() {
+#ifdef __linux__
+        for (int fd : fds) if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+    }
+
+    void stop() {
+#ifdef __linux__
+        for (int i = 0; i < CounterCount; i++) {
+            if (fds[i] < 0) continue;
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fds[i], &values[i], sizeof(uint64_t)) != sizeof(uint64_t)) {
+                close(fds[i]); // Reported as n/a from here on
+                fds[i] = -1;
+            }
+        }
+#endif
+    }
+
+    void report(uint64_t nodes) const {
+        const char* names[CounterCount] = { "Cycles", "Instructions", "Cache misses", "Branch misses" };
+        for (int i = 0; i < CounterCount; i++) {
+            cout << names[i] << ": ";
+            if (fds[i] < 0) { cout << "n/a\n"; continue; }
+            cout << values[i];
+            if (nodes > 0) cout << " (" << (double)values[i] / nodes << " per node)";
+            cout << newline;
+        }
+        if (fds[Cycles] >= 0 && fds[Instructions] >= 0 && values[Cycles] > 0)
+            cout << "IPC: " << (double)values[Instructions] / values[Cycles] << newline;
+    }
+
+private:
+    std::array<int, CounterCount> fds = { -1, -1, -1, -1 };
+    std::array<uint64_t, CounterCount> values = { 0 };
+};
+
+// Opens the counters if '--perf' was passed, prints a notice when they are unavailable
+bool openPerfCounters(PerfCounters& counters, bool requested) {
+    if (!requested) return false;
+    if (counters.open()) return true;
+    cout << "Hardware counters unavailable (check /proc/sys/kernel/perf_event_paranoid)\n";
+    return false;
+}
+
+// Usage: chess perft <depth> [fen] [--perf]
+int runPerft(int argc, char* argv[]) {
+    int depth = (argc > 2) ? std::atoi(argv[2]) : 4;
+    bool usePerf = false;
+    std::string fen;
+    for (int i = 3; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--perf") { usePerf = true; continue; }
+        if (arg.rfind("--", 0) == 0) continue;
+        fen += (fen.empty() ? "" : " ") + arg;
+    }
+
+    ChessBoard game;
+    bool isWhitesTurn = true;
+    if (!fen.empty() && !game.loadFen(fen, isWhitesTurn)) {
+        cout << "Invalid FEN: " << fen << newline;
+        return 1;
+    }
+
+    PerfCounters counters;
+    bool countersOpen = openPerfCounters(counters, usePerf);
+
+    auto start = std::chrono::steady_clock::now();
+    if (countersOpen) counters.start();
+    uint64_t nodes = game.perft(isWhitesTurn ? Piece::White : Piece::Black, depth);
+    if (countersOpen) counters.stop();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+    cout << "Perft(" << depth << "): " << nodes << newline;
+    cout << "Time: " << ms << " ms" << newline;
+    cout << "NPS: " << (nodes * 1000 / (ms + 1)) << newline;
+    if (countersOpen) counters.report(nodes);
+    return 0;
+}
+
+// Fixed positions for the bench signature, changing this list changes the signature
+const char* benchPositions[] = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w",
+    "r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w",
+    "r1bqk2r/pppp1ppp/2n2n2/2b1p3/2B1P3/2N2N2/PPPP1PPP/R1BQK2R w",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w",
+    "4k3/8/8/8/8/8/4P3/4K3 w",
+    "6k1/5ppp/8/8/8/8/5PPP/3R2K1 w",
+    "2r3k1/pp3ppp/8/3q4/8/1P3N2/P4PPP/2RQ2K1 b",
+};
+
+// Usage: chess bench [depth] [--perf]
+// The total node count is the signature: any change to search behavior changes it
+int runBench(int argc, char* argv[]) {
+    // '--threads N' runs the deterministic parallel search, node counts repeat exactly for a given N
+    int depth = 4;
+    int threads = 0;
+    bool usePerf = false;
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--perf") usePerf = true;
+        else if (arg == "--threads" && i + 1 < argc) threads = std::max(1, std::atoi(argv[++i]));
+        else if (arg.rfind("--", 0) != 0) depth = std::atoi(argv[i]);
+    }
+
+    PerfCounters counters;
+    bool countersOpen = openPerfCounters(counters, usePerf);
+
+    // Only the searches are timed and counted, clearing a large TT would otherwise dominate
+    uint64_t totalNodes = 0;
+    PruneStats totalStats;
+    std::chrono::steady_clock::duration elapsed{};
+    if (countersOpen) {
+        counters.start();
+        counters.pause();
+    }
+    for (const char* fen : benchPositions) {
+        ChessBoard game;
+        bool isWhitesTurn = true;
+        game.loadFen(fen, isWhitesTurn);
+        transpositionTable.clear();
+        std::unique_ptr<Search> search;
+        std::unique_ptr<DeterministicSearch> parallel;
+        if (threads > 0) parallel = std::make_unique<DeterministicSearch>(game, isWhitesTurn, threads);
+        else search = std::make_unique<Search>(game, isWhitesTurn);
+
+        auto start = std::chrono::steady_clock::now();
+        if (countersOpen) counters.resume();
+        SearchResult result = parallel ? parallel->run(depth) : search->run(depth);
+        if (countersOpen) counters.pause();
+        elapsed += std::chrono::steady_clock::now() - start;
+
+        totalNodes += result.nodes;
+        totalStats.add(parallel ? parallel->stats() : search->stats);
+        cout << fen << "  best " << moveToString(result.best) << "  nodes " << result.nodes << newline;
+    }
+    if (countersOpen) counters.stop();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+
+    cout << "\nNodes searched: " << totalNodes << newline;
+    cout << "Total time: " << ms << " ms" << newline;
+    cout << "NPS: " << (totalNodes * 1000 / (ms + 1)) << newline;
+    totalStats.print();
+    if (countersOpen) counters.report(totalNodes);
+    return 0;
+}
+
+// Plays one game between two parameter sets, returns 1 / 0 / -1 from White's view.
+// Games without a result after 'maxPlies' are scored as draws (the game has no repetition rule).
+int playGame(const char* fen, int depth, const SearchParams& white, const SearchParams& black,
+    TranspositionTable& whiteTable, TranspositionTable& blackTable, int maxPlies = 200) {
+    ChessBoard game;
+    bool isWhitesTurn = true;
+    game.loadFen(fen, isWhitesTurn);
+    whiteTable.clear();
+    blackTable.clear();
+
+    for (int ply = 0; ply < maxPlies; ply++) {
+        Search search(game, isWhitesTurn, isWhitesTurn ? whiteTable : blackTable);
+        search.params = isWhitesTurn ? white : black;
+        SearchResult result = search.run(depth);
+        if (result.pv.empty()) {
+            if (!game.isInCheck(isWhitesTurn ? Piece::White : Piece::Black)) return 0;
+            return isWhitesTurn ? -1 : 1;
+        }
+        game.doMove(result.best);
+        isWhitesTurn = !isWhitesTurn;
+    }
+    return 0;
+}
+
+// Usage: chess selfplay [games] [depth] [name=value ...]
+// The current parameters (see --param) play a reference that differs by the listed assignments
+// (pruning=0 when none are given). Colors alternate per opening.
+int runSelfPlay(int argc, char* argv[]) {
+    int games = (argc > 2) ? std::atoi(argv[2]) : 20;
+    int depth = (argc > 3) ? std::atoi(argv[3]) : 4;
+    SearchParams tested = searchParams;
+    SearchParams reference = searchParams;
+    std::string referenceName;
+    for (int i = 4; i < argc; i++) {
+        if (!setSearchParam(reference, argv[i])) {
+            cout << "Unknown search parameter: " << argv[i] << newline;
+            return 1;
+        }
+        referenceName += (referenceName.empty() ? "" : " ") + std::string(argv[i]);
+    }
+    if (referenceName.empty()) {
+        reference.pruning = false;
+        referenceName = "pruning=0";
+    }
+
+    TranspositionTable testedTable, referenceTable;
+    testedTable.resize(4);
+    referenceTable.resize(4);
+
+    int wins = 0, draws = 0, losses = 0;
+    const int openings = sizeof(benchPositions) / sizeof(benchPositions[0]);
+    for (int g = 0; g < games; g++) {
+        const char* fen = benchPositions[(g / 2) % openings];
+        bool testedIsWhite = (g % 2) == 0;
+        int result = testedIsWhite
+            ? playGame(fen, depth, tested, reference, testedTable, referenceTable)
+            : -playGame(fen, depth, reference, tested, referenceTable, testedTable);
+        if (result > 0) wins++;
+        else if (result < 0) losses++;
+        else draws++;
+        cout << "Game " << g + 1 << ": " << (result > 0 ? "win" : result < 0 ? "loss" : "draw") << newline;
+    }
+    cout << "\nCurrent vs " << referenceName << ": +" << wins << " =" << draws << " -" << losses
+        << " (" << 100.0 * (wins + 0.5 * draws) / std::max(games, 1) << "%)" << newline;
+    return 0;
+}
+
+// Usage: chess multipv <lines> <depth> [fen]
+// Prints every line per iteration, then compares the node count with a single-PV search of the same depth
+int runMultiPV(int argc, char* argv[]) {
+    int lines = (argc > 2) ? std::max(1, std::atoi(argv[2])) : 3;
+    int depth = (argc > 3) ? std::atoi(argv[3]) : 4;
+    std::string fen;
+    for (int i = 4; i < argc; i++) fen += (fen.empty() ? "" : " ") + std::string(argv[i]);
+
+    ChessBoard game;
+    bool isWhitesTurn = true;
+    if (!fen.empty() && !game.loadFen(fen, isWhitesTurn)) {
+        cout << "Invalid FEN: " << fen << newline;
+        return 1;
+    }
+
+    transpositionTable.clear();
+    Search single(game, isWhitesTurn);
+    uint64_t singleNodes = single.run(depth).nodes;
+
+    transpositionTable.clear();
+    Search multi(game, isWhitesTurn);
+    multi.multiPV = lines;
+    multi.verbose = true;
+    uint64_t multiNodes = multi.run(depth).nodes;
+
+    cout << "\nSingle-PV nodes: " << singleNodes << newline;
+    cout << "MultiPV " << lines << " nodes: " << multiNodes << newline;
+    cout << "Node overhead: " << (double)multiNodes / std::max<uint64_t>(singleNodes, 1) << "x" << newline;
+    return 0;
+}
+
+// Long single-position analysis that survives restarts: the TT is loaded from 'hashFile' when it
+// exists and saved back at the end, and at most every 30 s while deeper iterations complete.
+int runAnalyze(int argc, char* argv[]) {
+    if (argc < 4) {
+        cout << "Usage: analyze <depth> <hashFile> [fen]" << newline;
+        return 1;
+    }
+    int depth = std::max(1, std::atoi(argv[2]));
+    std::string hashFile = argv[3];
+    std::string fen;
+    for (int i = 4; i < argc; i++) fen += (fen.empty() ? "" : " ") + std::string(argv[i]);
+
+    ChessBoard game;
+    bool isWhitesTurn = true;
+    if (!fen.empty() && !game.loadFen(fen, isWhitesTurn)) {
+        cout << "Invalid FEN: " << fen << newline;
+        return 1;
+    }
+    uint64_t rootKey = game.hashKey() ^ (isWhitesTurn ? 0 : zobrist.blackToMove);
+
+    auto elapsedMs = [](std::chrono::steady_clock::time_point since) {
+        return (long long)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - since).count();
+    };
+    auto loadStart = std::chrono::steady_clock::now();
+    if (transpositionTable.load(hashFile, rootKey)) {
+        cout << "Loaded " << (transpositionTable.sizeBytes() >> 20) << " MB hash from " << hashFile << " in " << elapsedMs(loadStart) << " ms" << newline;
+    } else {
+        cout << "No usable hash file at " << hashFile << ", starting empty" << newline;
+        transpositionTable.clear();
+    }
+
+    auto save = [&]() {
+        auto saveStart = std::chrono::steady_clock::now();
+        if (transpositionTable.save(hashFile, rootKey)) cout << "Saved hash to " << hashFile << " in " << elapsedMs(saveStart) << " ms" << newline;
+        else cout << "Could not write " << hashFile << newline;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    auto lastSave = start;
+    Search search(game, isWhitesTurn);
+    search.verbose = true;
+    search.onIteration = [&](const SearchResult& result) {
+        cout << "depth " << result.depth << " done after " << elapsedMs(start) << " ms" << newline;
+        if (result.depth < depth && elapsedMs(lastSave) >= 30000) {
+            save();
+            lastSave = std::chrono::steady_clock::now();
+        }
+    };
+    SearchResult result = search.run(depth);
+    save();
+
+    cout << "\nBest move: " << moveToString(result.best) << " score " << result.score << " nodes " << result.nodes << newline;
+    return 0;
+}
+
+// --- Training Data ---
+// Scored positions from fixed-node self-play, one fixed-size record each. Squares hold a 4-bit
+// piece code (type, +8 for Black) two per byte, square 0 (a8) in the low nibble of byte 0.
+// Score and result are from the side to move's view.
+
+struct PositionRecord {
+    uint8_t squares[32];
+    int16_t score;
+    int8_t result; // 1 win, 0 draw, -1 loss
+    uint8_t blackToMove;
+};
+static_assert(sizeof(PositionRecord) == 36, "Records are written to disk as is");
+
+PositionRecord packPosition(const ChessBoard& board, bool isWhitesTurn) {
+    PositionRecord record = {};
+    for (int sq = 0; sq < 64; sq++) {
+        uint8_t p = board.pieceAt(sq / 8, sq % 8);
+        uint8_t code = (p == Piece::None) ? 0 : (p & typeMask) | ((p & Piece::Black) ? 8 : 0);
+        record.squares[sq / 2] |= code << ((sq % 2) * 4);
+    }
+    record.blackToMove = isWhitesTurn ? 0 : 1;
+    return record;
+}
+
+// Piece on 'square' in the board's encoding
+uint8_t recordPiece(const PositionRecord& record, int square) {
+    uint8_t code = (record.squares[square / 2] >> ((square % 2) * 4)) & 15;
+    if (code == 0) return Piece::None;
+    return (code & typeMask) | ((code & 8) ? Piece::Black : Piece::White);
+}
+
+// Same key as ChessBoard::hashKey() plus the side to move, as the search uses
+uint64_t recordKey(const PositionRecord& record) {
+    uint64_t key = record.blackToMove ? zobrist.blackToMove : 0;
+    for (int sq = 0; sq < 64; sq++) {
+        uint8_t p = recordPiece(record, sq);
+        if (p != Piece::None) key ^= zobrist.piece(p, sq);
+    }
+    return key;
+}
+
+// Records in the file at 'path', false if it cannot be read or ends in a partial record.
+// Goes through std::filesystem because ftell's long is 32 bits on Windows.
+bool recordFileCount(const std::string& path, uint64_t& count) {
+    std::error_code error;
+    uint64_t bytes = std::filesystem::file_size(path, error);
+    if (error || bytes % sizeof(PositionRecord) != 0) return false;
+    count = bytes / sizeof(PositionRecord);
+    return true;
+}
+
+// FEN of a record, for handing it to code that works on a ChessBoard
+std::string recordFen(const PositionRecord& record) {
+    return fenPlacement([&record](int sq) { return recordPiece(record, sq); }) + (record.blackToMove ? " b" : " w");
+}
+
+struct DatagenConfig {
+    uint64_t nodes = 5000;
+    int randomPlies = 8; // Uniformly random opening moves, so games do not repeat
+    int maxPlies = 300;  // Drawn after this, the game has no repetition or 50-move rule
+};
+
+constexpr size_t datagenHashMB = 4;
+
+// Plays one game and appends its quiet positions to 'out'. The seed fixes the opening, so a game
+// index produces the same game whatever thread plays it. Returns the number of positions searched.
+uint64_t generateGame(uint64_t seed, const DatagenConfig& config, TranspositionTable& table, std::vector<PositionRecord>& out) {
+    auto random = [&seed]() { // splitmix64
+        uint64_t z = (seed += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    };
+
+    ChessBoard game;
+    bool isWhitesTurn = true;
+    std::vector<Move> moves;
+    for (int ply = 0; ply < config.randomPlies; ply++) {
+        moves.clear();
+        game.generateMoves(isWhitesTurn ? Piece::White : Piece::Black, moves);
+        if (moves.empty()) return 0; // Over before it started, nothing worth recording
+        game.doMove(moves[random() % moves.size()]);
+        isWhitesTurn = !isWhitesTurn;
+    }
+
+    table.clear();
+    size_t first = out.size();
+    uint64_t searched = 0;
+    int whiteResult = 0;
+    Search search(game, isWhitesTurn, table);
+    search.nodeLimit = config.nodes;
+    for (int ply = 0; ply < config.maxPlies; ply++) {
+        uint8_t color = isWhitesTurn ? Piece::White : Piece::Black;
+        search.reset(game, isWhitesTurn);
+        SearchResult result = search.run(MaxPly / 2);
+        if (result.pv.empty()) {
+            if (game.isInCheck(color)) whiteResult = isWhitesTurn ? -1 : 1;
+            break;
+        }
+        searched++;
+
+        // A found mate decides the game, playing it out adds nothing
+        if (std::abs(result.score) >= MateScore - MaxPly) {
+            whiteResult = ((result.score > 0) == isWhitesTurn) ? 1 : -1;
+            break;
+        }
+        // The static eval of checks and captures says little about the searched score
+        if (!game.isInCheck(color) && result.best.captured == Piece::None) {
+            PositionRecord record = packPosition(game, isWhitesTurn);
+            record.score = (int16_t)result.score;
+            out.push_back(record);
+        }
+        game.doMove(result.best);
+        isWhitesTurn = !isWhitesTurn;
+    }
+
+    for (size_t i = first; i < out.size(); i++) out[i].result = (int8_t)(out[i].blackToMove ? -whiteResult : whiteResult);
+    return searched;
+}
+
+// Usage: chess datagen <games> <nodes> <file> [threads]
+// Plays the games on all cores (or 'threads'), appending records to 'file'
+int runDatagen(int argc, char* argv[]) {
+    if (argc < 5) {
+        cout << "Usage: datagen <games> <nodes> <file> [threads]" << newline;
+        return 1;
+    }
+    int games = std::max(1, std::atoi(argv[2]));
+    DatagenConfig config;
+    config.nodes = std::max(1, std::atoi(argv[3]));
+    std::string path = argv[4];
+    int threads = (argc > 5) ? std::max(1, std::atoi(argv[5])) : std::max(1u, std::thread::hardware_concurrency());
+
+    FILE* file = std::fopen(path.c_str(), "ab");
+    if (!file) {
+        cout << "Could not open " << path << newline;
+        return 1;
+    }
+
+    std::atomic<int> nextGame{ 0 };
+    std::atomic<uint64_t> searched{ 0 }, written{ 0 };
+    std::mutex fileMutex;
+    int writeError = 0; // errno of the first failed write
+    auto worker = [&]() {
+        TranspositionTable table;
+        table.resize(datagenHashMB);
+        std::vector<PositionRecord> buffer;
+        auto flush = [&]() {
+            std::lock_guard<std::mutex> lock(fileMutex);
+            size_t count = std::fwrite(buffer.data(), sizeof(PositionRecord), buffer.size(), file);
+            if (count != buffer.size() && !writeError) writeError = errno ? errno : EIO;
+            written += count;
+            buffer.clear();
+        };
+        for (int g = nextGame++; g < games; g = nextGame++) {
+            searched += generateGame((uint64_t)g, config, table, buffer);
+            if (buffer.size() >= 4096) flush();
+        }
+        flush();
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) workers.emplace_back(worker);
+    for (std::thread& w : workers) w.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (std::fclose(file) != 0 && !writeError) writeError = errno ? errno : EIO;
+    if (writeError) {
+        cout << "Write to " << path << " failed after " << written << " records: " << std::strerror(writeError) << newline;
+        return 1;
+    }
+
+    cout << "Games: " << games << ", threads: " << threads << ", nodes per move: " << config.nodes << newline;
+    cout << "Positions searched: " << searched << ", written: " << written << " (" << written * sizeof(PositionRecord) / 1024 << " KiB)" << newline;
+    cout << "Time: " << (long long)(seconds * 1000) << " ms" << newline;
+    cout << "Positions/s: " << (uint64_t)(written / seconds) << ", per core: " << (uint64_t)(written / seconds / threads) << newline;
+    return 0;
+}
+
+// --- Dataset Shuffling ---
+// Deduplicates and shuffles record files larger than memory, in bounded memory and with at most
+// shuffleFanOut bucket files open at a time.
+// Partition: records are scattered into bucket files by their Zobrist key, eight key bits per level,
+// and any bucket still too large for the budget is split again; equal positions stay together, and a
+// bucket that is still too large after all 64 bits holds a single position, so one copy is kept.
+// Dedup: each bucket is loaded, the first record of every key is kept and sent to a random pile.
+// Shuffle: each pile (split again at random if too large) is shuffled in memory and appended to the
+// output chunks. Random piles shuffled and concatenated give a uniform shuffle of the whole set.
+
+constexpr size_t shuffleFanOut = 256;   // Bucket files open at once, well under the usual 1024 fd limit
+constexpr size_t dedupBytesPerRecord = sizeof(PositionRecord) + 16 + 1; // Record, sort key, keep flag (rounded up)
+
+struct ShuffleConfig {
+    size_t memoryMB = 256;
+    size_t chunkRecords = 1 << 20;
+    size_t bufferRecords = 4096; // Per open bucket file, derived from the budget by runShuffle
+};
+
+inline uint64_t splitmix64(uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Buffered writes to a set of bucket files. stdio buffering is turned off, the budgeted
+// 'bufferRecords' per file is the only buffer.
+class ScatterWriter {
+public:
+    bool open(const std::vector<std::string>& paths, size_t bufferRecords) {
+        capacity = bufferRecords;
+        files.assign(paths.size(), nullptr);
+        pending.assign(paths.size(), {});
+        sizes.assign(paths.size(), 0);
+        for (size_t b = 0; b < paths.size(); b++) {
+            files[b] = std::fopen(paths[b].c_str(), "wb");
+            if (!files[b]) return ok = false;
+            std::setvbuf(files[b], nullptr, _IONBF, 0);
+            pending[b].reserve(capacity);
+        }
+        return ok = true;
+    }
+
+    void add(size_t b, const PositionRecord& record) {
+        pending[b].push_back(record);
+        sizes[b]++;
+        if (pending[b].size() >= capacity) flush(b);
+    }
+
+    // Flushes and closes every file, returns false if any write failed
+    bool close() {
+        for (size_t b = 0; b < files.size(); b++) {
+            if (!files[b]) continue;
+            flush(b);
+            ok = (std::fclose(files[b]) == 0) && ok;
+            files[b] = nullptr;
+        }
+        pending.clear();
+        return ok;
+    }
+
+    std::vector<uint64_t> sizes;
+
+private:
+    std::vector<FILE*> files;
+    std::vector<std::vector<PositionRecord>> pending;
+    size_t capacity = 1;
+    bool ok = true;
+
+    void flush(size_t b) {
+        ok = ok && std::fwrite(pending[b].data(), sizeof(PositionRecord), pending[b].size(), files[b]) == pending[b].size();
+        pending[b].clear();
+    }
+};
+
+// Appends records to <prefix>-0000.bin, <prefix>-0001.bin, ... 'chunkRecords' at a time
+class ChunkWriter {
+public:
+    ChunkWriter(const std::string& filePrefix, size_t recordsPerChunk) : prefix(filePrefix), chunkRecords(recordsPerChunk) {}
+
+    bool write(const PositionRecord* records, size_t count) {
+        while (ok && count > 0) {
+            if (!out || inChunk == chunkRecords) {
+                finishChunk();
+                char name[32];
+                std::snprintf(name, sizeof(name), "-%04zu.bin", chunks++);
+                out = std::fopen((prefix + name).c_str(), "wb");
+                inChunk = 0;
+                if (!out) return ok = false;
+            }
+            size_t n = std::min(count, chunkRecords - inChunk);
+            ok = std::fwrite(records, sizeof(PositionRecord), n, out) == n;
+            records += n;
+            count -= n;
+            inChunk += n;
+        }
+        return ok;
+    }
+
+    bool finish() {
+        finishChunk();
+        return ok;
+    }
+
+    size_t chunks = 0;
+
+private:
+    std::string prefix;
+    size_t chunkRecords;
+    FILE* out = nullptr;
+    size_t inChunk = 0;
+    bool ok = true;
+
+    void finishChunk() {
+        if (out) ok = (std::fclose(out) == 0) && ok;
+        out = nullptr;
+    }
+};
+
+class ExternalShuffler {
+public:
+    ExternalShuffler(const std::string& outputPrefix, const ShuffleConfig& shuffleConfig)
+        : chunks(outputPrefix, shuffleConfig.chunkRecords), prefix(outputPrefix), config(shuffleConfig) {
+        uint64_t budget = (uint64_t)config.memoryMB * 1024 * 1024;
+        // Dedup holds one bucket while the pile buffers fill, each gets half the budget
+        bucketCapacity = std::min<uint64_t>(budget / 2 / dedupBytesPerRecord, UINT32_MAX);
+        pileCapacity = budget / sizeof(PositionRecord);
+    }
+
+    ~ExternalShuffler() { for (const std::string& path : temps) std::remove(path.c_str()); }
+
+    ExternalShuffler(const ExternalShuffler&) = delete;
+    ExternalShuffler& operator=(const ExternalShuffler&) = delete;
+
+    // Returns false with 'error' set when a file fails or the budget cannot be met
+    bool run(const std::string& input, uint64_t total) {
+        std::vector<std::pair<std::string, uint64_t>> buckets;
+        if (!partition(input, false, total, 0, buckets)) return false;
+        partitionTime = elapsed();
+
+        // Piles receive the unique records, sized from the total since the unique count is not known yet
+        size_t pileCount = fanOutFor(total, pileCapacity);
+        std::vector<std::string> pilePaths;
+        for (size_t p = 0; p < pileCount; p++) pilePaths.push_back(tempPath("pile", p));
+        ScatterWriter piles;
+        if (!piles.open(pilePaths, config.bufferRecords)) return fail("Could not create pile files");
+        bucketsProcessed = buckets.size();
+        for (const auto& bucket : buckets) {
+            if (!dedupBucket(bucket.first, bucket.second, pileCount, piles)) { piles.close(); return false; }
+            if (bucket.first != input) std::remove(bucket.first.c_str());
+        }
+        if (!piles.close()) return fail("Could not write pile files");
+        dedupTime = elapsed() - partitionTime;
+
+        for (size_t p = 0; p < pileCount; p++)
+            if (!shufflePile(pilePaths[p], piles.sizes[p])) return false;
+        if (!chunks.finish()) return fail("Could not write output chunks");
+        return true;
+    }
+
+    std::string error;
+    uint64_t kept = 0;
+    size_t bucketsProcessed = 0;
+    double partitionTime = 0, dedupTime = 0;
+    ChunkWriter chunks;
+
+private:
+    std::string prefix;
+    ShuffleConfig config;
+    uint64_t bucketCapacity, pileCapacity;
+    uint64_t seed = 0x2545F4914F6CDD1Dull;
+    size_t tempFiles = 0;
+    std::vector<std::string> temps; // Every temporary path handed out, removed by the destructor
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    double elapsed() const { return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); }
+
+    bool fail(const std::string& message) {
+        if (error.empty()) error = message;
+        return false;
+    }
+
+    std::string tempPath(const char* kind, size_t index) {
+        temps.push_back(prefix + "." + kind + "-" + std::to_string(tempFiles++) + "-" + std::to_string(index) + ".tmp");
+        return temps.back();
+    }
+
+    // Enough files to bring 'records' to half of 'capacity' each, leaving room for uneven splits
+    static size_t fanOutFor(uint64_t records, uint64_t capacity) {
+        size_t count = 1;
+        while (count < shuffleFanOut && records / count > capacity / 2) count *= 2;
+        return count;
+    }
+
+    // Reads 'path' and sends every record to the file chosen by 'route'
+    template <class Route>
+    bool scatter(const std::string& path, const std::vector<std::string>& children, std::vector<uint64_t>& sizes, Route route) {
+        FILE* in = std::fopen(path.c_str(), "rb");
+        if (!in) return fail("Could not open " + path);
+        ScatterWriter writer;
+        bool ok = writer.open(children, config.bufferRecords);
+        std::vector<PositionRecord> chunk(config.bufferRecords);
+        size_t count;
+        while (ok && (count = std::fread(chunk.data(), sizeof(PositionRecord), chunk.size(), in)) > 0)
+            for (size_t i = 0; i < count; i++) writer.add(route(chunk[i]), chunk[i]);
+        ok = !std::ferror(in) && ok;
+        std::fclose(in);
+        ok = writer.close() && ok;
+        sizes = writer.sizes;
+        return ok || fail("Could not split " + path);
+    }
+
+    // Splits by eight key bits per level until every bucket fits, 'owned' files are removed once split
+    bool partition(const std::string& path, bool owned, uint64_t records, int keyBits, std::vector<std::pair<std::string, uint64_t>>& out) {
+        if (records <= bucketCapacity) {
+            out.push_back({ path, records });
+            return true;
+        }
+        if (keyBits >= 64) return keepFirst(path, out);
+        size_t fanOut = fanOutFor(records, bucketCapacity);
+        int bits = 0;
+        while (((size_t)1 << bits) < fanOut) bits++;
+        bits = std::min(bits, 64 - keyBits);
+        std::vector<std::string> children;
+        for (size_t b = 0; b < ((size_t)1 << bits); b++) children.push_back(tempPath("bucket", b));
+        std::vector<uint64_t> sizes;
+        bool ok = scatter(path, children, sizes, [&](const PositionRecord& r) {
+            return (size_t)((recordKey(r) << keyBits) >> (64 - bits));
+        });
+        if (owned) std::remove(path.c_str());
+        for (size_t b = 0; ok && b < children.size(); b++) ok = partition(children[b], true, sizes[b], keyBits + bits, out);
+        return ok;
+    }
+
+    // Every record in a bucket split on all 64 key bits is the same position, only the first is kept
+    bool keepFirst(const std::string& path, std::vector<std::pair<std::string, uint64_t>>& out) {
+        PositionRecord first;
+        FILE* file = std::fopen(path.c_str(), "rb");
+        bool ok = file && std::fread(&first, sizeof(first), 1, file) == 1;
+        if (file) std::fclose(file);
+        file = ok ? std::fopen(path.c_str(), "wb") : nullptr;
+        ok = file && std::fwrite(&first, sizeof(first), 1, file) == 1;
+        if (file) ok = (std::fclose(file) == 0) && ok;
+        if (!ok) return fail("Could not rewrite " + path);
+        out.push_back({ path, 1 });
+        return true;
+    }
+
+    // Keeps the first record of each key: sort (key, index), flag the first of each run, compact in place
+    bool dedupBucket(const std::string& path, uint64_t records, size_t pileCount, ScatterWriter& piles) {
+        std::vector<PositionRecord> bucket(records);
+        FILE* in = std::fopen(path.c_str(), "rb");
+        bool ok = in && std::fread(bucket.data(), sizeof(PositionRecord), bucket.size(), in) == bucket.size();
+        if (in) std::fclose(in);
+        if (!ok) return fail("Could not read " + path);
+
+        std::vector<bool> keep(bucket.size());
+        {
+            std::vector<std::pair<uint64_t, uint32_t>> keys(bucket.size());
+            for (size_t i = 0; i < bucket.size(); i++) keys[i] = { recordKey(bucket[i]), (uint32_t)i };
+            std::sort(keys.begin(), keys.end()); // Ties by index, so the first occurrence is kept
+            for (size_t i = 0; i < keys.size(); i++)
+                if (i == 0 || keys[i].first != keys[i - 1].first) keep[keys[i].second] = true;
+        }
+        for (size_t i = 0; i < bucket.size(); i++) {
+            if (!keep[i]) continue;
+            piles.add(splitmix64(seed) % pileCount, bucket[i]);
+            kept++;
+        }
+        return true;
+    }
+
+    bool shufflePile(const std::string& path, uint64_t records) {
+        if (records > pileCapacity) {
+            size_t fanOut = fanOutFor(records, pileCapacity);
+            std::vector<std::string> children;
+            for (size_t p = 0; p < fanOut; p++) children.push_back(tempPath("pile", p));
+            std::vector<uint64_t> sizes;
+            bool ok = scatter(path, children, sizes, [&](const PositionRecord&) { return (size_t)(splitmix64(seed) % fanOut); });
+            std::remove(path.c_str());
+            for (size_t p = 0; ok && p < children.size(); p++) ok = shufflePile(children[p], sizes[p]);
+            return ok;
+        }
+        std::vector<PositionRecord> pile(records);
+        FILE* in = std::fopen(path.c_str(), "rb");
+        bool ok = in && std::fread(pile.data(), sizeof(PositionRecord), pile.size(), in) == pile.size();
+        if (in) std::fclose(in);
+        std::remove(path.c_str());
+        if (!ok) return fail("Could not read " + path);
+        for (size_t i = pile.size(); i > 1; i--) std::swap(pile[i - 1], pile[splitmix64(seed) % i]);
+        return chunks.write(pile.data(), pile.size()) || fail("Could not write output chunks");
+    }
+};
+
+// Usage: chess shuffle <in> <outPrefix> [memoryMB] [chunkRecords]
+// Writes <outPrefix>-0000.bin, <outPrefix>-0001.bin, ... with 'chunkRecords' records each (the last may be short)
+int runShuffle(int argc, char* argv[]) {
+    if (argc < 4) {
+        cout << "Usage: shuffle <in> <outPrefix> [memoryMB] [chunkRecords]" << newline;
+        return 1;
+    }
+    std::string input = argv[2];
+    std::string prefix = argv[3];
+    ShuffleConfig config;
+    if (argc > 4) config.memoryMB = std::max(1, std::atoi(argv[4]));
+    if (argc > 5) config.chunkRecords = std::max(1, std::atoi(argv[5]));
+    // Open bucket buffers take at most a quarter of the budget
+    config.bufferRecords = std::max<size_t>(1, std::min<size_t>(config.bufferRecords,
+        config.memoryMB * 1024 * 1024 / 4 / (shuffleFanOut * sizeof(PositionRecord))));
+
+    uint64_t total = 0;
+    if (!recordFileCount(input, total)) {
+        cout << "Not a record file: " << input << newline;
+        return 1;
+    }
+
+    ExternalShuffler shuffler(prefix, config);
+    auto start = std::chrono::steady_clock::now();
+    if (!shuffler.run(input, total)) {
+        cout << "Shuffle failed: " << shuffler.error << newline;
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    cout << "Records: " << total << ", unique: " << shuffler.kept << " (" << total - shuffler.kept << " duplicates dropped)" << newline;
+    cout << "Buckets: " << shuffler.bucketsProcessed << ", chunks: " << shuffler.chunks.chunks << " of up to " << config.chunkRecords << " records" << newline;
+    cout << "Time: partition " << (long long)(shuffler.partitionTime * 1000) << " ms, dedup " << (long long)(shuffler.dedupTime * 1000)
+        << " ms, shuffle " << (long long)((seconds - shuffler.partitionTime - shuffler.dedupTime) * 1000) << " ms" << newline;
+    cout << "Records/s: " << (uint64_t)(total / seconds) << newline;
+    return 0;
+}
+
+// --- NNUE Training ---
+// Mini-batch Adam over PositionRecords on the CPU. The float network uses the evaluator's layout
+// and is exported quantized. Only the rows of active inputs (at most 32 per perspective) are
+// touched in the forward and backward passes, the batch is split across a pool of threads, each
+// with its own sparse gradient. Zeroing, reduction and the optimizer step visit only the first-layer
+// rows the batch touched plus the small dense layers, so the first layer gets lazy Adam: a row's
+// moments only advance in batches that use it. The target blends the search score and the game result.
+
+struct TrainerConfig {
+    int epochs = 10;
+    int threads = 1;
+    size_t batchSize = 4096;
+    size_t chunkRecords = 1 << 20; // Records read and shuffled at a time
+    float learningRate = 0.001f;
+    float lambda = 0.75f; // Weight of the search score in the target, the rest is the result
+};
+
+// Offsets into the flat parameter (and gradient) vector
+constexpr size_t TrainInput = 0;
+constexpr size_t TrainInputBias = TrainInput + NnueInputs * NnueHidden;
+constexpr size_t TrainOutput = TrainInputBias + NnueHidden;
+constexpr size_t TrainOutputBias = TrainOutput + 2 * NnueHidden;
+constexpr size_t TrainParams = TrainOutputBias + 1;
+
+// dst += scale * src over NnueHidden floats
+inline void addScaledRow(float* dst, const float* src, float scale) {
+#ifdef __AVX2__
+    const __m256 s = _mm256_set1_ps(scale);
+    for (int i = 0; i < NnueHidden; i += 8) {
+        __m256 d = _mm256_loadu_ps(dst + i);
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(d, _mm256_mul_ps(s, _mm256_loadu_ps(src + i))));
+    }
+#else
+    for (int i = 0; i < NnueHidden; i++) dst[i] += scale * src[i];
+#endif
+}
+
+inline float sigmoid(float x) { return 1.0f / (1.0f + std::exp(-x)); }
+
+// One thread's gradient. First-layer rows are nonzero only if listed in 'rows', everything past
+// TrainInputBias is dense. Whoever consumes the gradient zeroes what it used.
+struct TrainerGradient {
+    std::vector<float> values = std::vector<float>(TrainParams, 0.0f);
+    std::vector<uint8_t> touched = std::vector<uint8_t>(NnueInputs, 0);
+    std::vector<int> rows;
+    double loss = 0;
+
+    float* row(int feature) {
+        if (!touched[feature]) {
+            touched[feature] = 1;
+            rows.push_back(feature);
+        }
+        return values.data() + TrainInput + feature * NnueHidden;
+    }
+
+    void clearRows() {
+        for (int feature : rows) {
+            std::fill_n(values.data() + TrainInput + feature * NnueHidden, NnueHidden, 0.0f);
+            touched[feature] = 0;
+        }
+        rows.clear();
+    }
+};
+
+// Runs a job on every thread and waits for all of them. The threads live as long as the pool,
+// so training does not start and join new ones for every mini-batch.
+class TrainerPool {
+public:
+    explicit TrainerPool(int threadCount) {
+        for (int t = 1; t < threadCount; t++) threads.emplace_back([this, t]() { loop(t); });
+    }
+
+    ~TrainerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quitting = true;
+        }
+        wake.notify_all();
+        for (std::thread& thread : threads) thread.join();
+    }
+
+    TrainerPool(const TrainerPool&) = delete;
+    TrainerPool& operator=(const TrainerPool&) = delete;
+
+    // Calls work(t) for every thread index t, the caller runs index 0
+    void run(const std::function<void(int)>& work) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &work;
+            pending = threads.size();
+            generation++;
+        }
+        wake.notify_all();
+        work(0);
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]() { return pending == 0; });
+    }
+
+private:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    const std::function<void(int)>* job = nullptr;
+    uint64_t generation = 0;
+    size_t pending = 0;
+    bool quitting = false;
+
+    void loop(int t) {
+        uint64_t seen = 0;
+        for (;;) {
+            const std::function<void(int)>* current;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]() { return quitting || generation != seen; });
+                if (quitting) return;
+                seen = generation;
+                current = job;
+            }
+            (*current)(t);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                pending--;
+            }
+            done.notify_one();
+        }
+    }
+};
+
+// Network output for 'record' in units of NnueScale centipawns. 'acc' receives both pre-activation
+// accumulators, side to move first, and 'features' the active inputs per perspective.
+float trainerForward(const PositionRecord& record, const float* params, float (*acc)[NnueHidden], int (*features)[32], int* counts) {
+    uint8_t stm = record.blackToMove ? Piece::Black : Piece::White;
+    uint8_t perspectives[2] = { stm, opposite(stm) };
+    counts[0] = counts[1] = 0;
+    for (int sq = 0; sq < 64; sq++) {
+        uint8_t p = recordPiece(record, sq);
+        if (p == Piece::None || counts[0] == 32) continue;
+        for (int k = 0; k < 2; k++) features[k][counts[k]++] = nnueFeature(p, sq, perspectives[k]);
+    }
+
+    float out = params[TrainOutputBias];
+    for (int k = 0; k < 2; k++) {
+        std::copy(params + TrainInputBias, params + TrainInputBias + NnueHidden, acc[k]);
+        for (int j = 0; j < counts[k]; j++) addScaledRow(acc[k], params + TrainInput + features[k][j] * NnueHidden, 1.0f);
+        const float* w = params + TrainOutput + k * NnueHidden;
+        for (int i = 0; i < NnueHidden; i++) out += std::clamp(acc[k][i], 0.0f, 1.0f) * w[i];
+    }
+    return out;
+}
+
+// Adds the squared-error gradient of one record to 'gradient', returns its loss
+float trainerBackward(const PositionRecord& record, const float* params, TrainerGradient& gradient, float lambda) {
+    alignas(32) float acc[2][NnueHidden];
+    int features[2][32];
+    int counts[2];
+    float p = sigmoid(trainerForward(record, params, acc, features, counts));
+    float target = lambda * sigmoid((float)record.score / NnueScale) + (1 - lambda) * (record.result + 1) * 0.5f;
+    float error = p - target;
+    float dOut = 2 * error * p * (1 - p);
+
+    float* grad = gradient.values.data();
+    grad[TrainOutputBias] += dOut;
+    alignas(32) float dHidden[NnueHidden];
+    for (int k = 0; k < 2; k++) {
+        const float* w = params + TrainOutput + k * NnueHidden;
+        float* gw = grad + TrainOutput + k * NnueHidden;
+        for (int i = 0; i < NnueHidden; i++) {
+            float a = acc[k][i];
+            gw[i] += dOut * std::clamp(a, 0.0f, 1.0f);
+            dHidden[i] = (a > 0 && a < 1) ? dOut * w[i] : 0;
+        }
+        addScaledRow(grad + TrainInputBias, dHidden, 1.0f);
+        for (int j = 0; j < counts[k]; j++) addScaledRow(gradient.row(features[k][j]), dHidden, 1.0f);
+    }
+    return error * error;
+}
+
+bool exportNnue(const std::vector<float>& params, const std::string& path) {
+    auto quantize = [](float x, float scale) { return (int16_t)std::clamp(std::lround(x * scale), -32767L, 32767L); };
+    std::vector<int16_t> input(NnueInputs * NnueHidden), bias(NnueHidden), output(2 * NnueHidden);
+    for (size_t i = 0; i < input.size(); i++) input[i] = quantize(params[TrainInput + i], NnueQA);
+    for (size_t i = 0; i < bias.size(); i++) bias[i] = quantize(params[TrainInputBias + i], NnueQA);
+    for (size_t i = 0; i < output.size(); i++) output[i] = quantize(params[TrainOutput + i], NnueQB);
+    int32_t outputBias = (int32_t)std::lround(params[TrainOutputBias] * NnueQA * NnueQB);
+    uint32_t hidden = NnueHidden;
+
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) return false;
+    bool ok = std::fwrite(nnueMagic, sizeof(nnueMagic), 1, file) == 1
+        && std::fwrite(&hidden, sizeof(hidden), 1, file) == 1
+        && std::fwrite(input.data(), sizeof(int16_t), input.size(), file) == input.size()
+        && std::fwrite(bias.data(), sizeof(int16_t), bias.size(), file) == bias.size()
+        && std::fwrite(output.data(), sizeof(int16_t), output.size(), file) == output.size()
+        && std::fwrite(&outputBias, sizeof(outputBias), 1, file) == 1;
+    return (std::fclose(file) == 0) && ok;
+}
+
+// Streams 'path' once per epoch in shuffled chunks into 'params', false if the file cannot be read
+bool trainNnue(const std::string& path, const TrainerConfig& config, std::vector<float>& params) {
+    uint64_t seed = 0x5DEECE66Dull;
+    auto random = [&seed]() { // splitmix64
+        uint64_t z = (seed += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    };
+    auto uniform = [&random](float range) { return ((float)(random() >> 40) / (1 << 24) * 2 - 1) * range; };
+
+    params.assign(TrainParams, 0.0f);
+    for (size_t i = TrainInput; i < TrainInputBias; i++) params[i] = uniform(0.1f);
+    for (size_t i = TrainOutput; i < TrainOutputBias; i++) params[i] = uniform(0.1f);
+    std::vector<float> moment(TrainParams), velocity(TrainParams);
+    std::vector<TrainerGradient> grads(config.threads);
+    const float beta1 = 0.9f, beta2 = 0.999f, epsilon = 1e-8f;
+    uint64_t step = 0;
+    TrainerPool pool(config.threads);
+
+    std::vector<PositionRecord> chunk(config.chunkRecords);
+    for (int epoch = 1; epoch <= config.epochs; epoch++) {
+        FILE* file = std::fopen(path.c_str(), "rb");
+        if (!file) return false;
+        auto start = std::chrono::steady_clock::now();
+        double lossSum = 0;
+        uint64_t samples = 0;
+        size_t count;
+        while ((count = std::fread(chunk.data(), sizeof(PositionRecord), chunk.size(), file)) > 0) {
+            for (size_t i = count - 1; i > 0; i--) std::swap(chunk[i], chunk[random() % (i + 1)]);
+
+            for (size_t first = 0; first < count; first += config.batchSize) {
+                size_t last = std::min(count, first + config.batchSize);
+                pool.run([&](int t) {
+                    size_t span = (last - first + config.threads - 1) / config.threads;
+                    size_t end = std::min(last, first + (t + 1) * span);
+                    for (size_t i = first + t * span; i < end; i++) grads[t].loss += trainerBackward(chunk[i], params.data(), grads[t], config.lambda);
+                });
+
+                // Sum into thread 0's gradient, zeroing the others for the next batch
+                TrainerGradient& sum = grads[0];
+                for (int t = 1; t < config.threads; t++) {
+                    for (int feature : grads[t].rows) addScaledRow(sum.row(feature), grads[t].values.data() + TrainInput + feature * NnueHidden, 1.0f);
+                    grads[t].clearRows();
+                    for (size_t i = TrainInputBias; i < TrainParams; i++) sum.values[i] += grads[t].values[i];
+                    std::fill(grads[t].values.begin() + TrainInputBias, grads[t].values.end(), 0.0f);
+                }
+                for (int t = 0; t < config.threads; t++) {
+                    lossSum += grads[t].loss;
+                    grads[t].loss = 0;
+                }
+                samples += last - first;
+
+                step++;
+                float scale = 1.0f / (last - first);
+                float correction1 = 1 - std::pow(beta1, (float)step);
+                float correction2 = 1 - std::pow(beta2, (float)step);
+                auto adam = [&](size_t i) {
+                    float g = sum.values[i] * scale;
+                    moment[i] = beta1 * moment[i] + (1 - beta1) * g;
+                    velocity[i] = beta2 * velocity[i] + (1 - beta2) * g * g;
+                    params[i] -= config.learningRate * (moment[i] / correction1) / (std::sqrt(velocity[i] / correction2) + epsilon);
+                };
+                for (int feature : sum.rows) {
+                    size_t row = TrainInput + (size_t)feature * NnueHidden;
+                    for (size_t i = row; i < row + NnueHidden; i++) adam(i);
+                }
+                for (size_t i = TrainInputBias; i < TrainParams; i++) adam(i);
+                sum.clearRows();
+                std::fill(sum.values.begin() + TrainInputBias, sum.values.end(), 0.0f);
+            }
+        }
+        bool readError = std::ferror(file);
+        std::fclose(file);
+        if (readError) return false;
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::printf("Epoch %d: loss %.6f, %llu positions, %.0f positions/s\n", epoch, lossSum / std::max<uint64_t>(samples, 1),
+            (unsigned long long)samples, samples / seconds);
+        std::fflush(stdout);
+    }
+    return true;
+}
+
+// Usage: chess train <records> <out.nnue> [epochs] [threads]
+// Trains on a datagen file and exports the quantized network, then checks it against the float one
+int runTrain(int argc, char* argv[]) {
+    if (argc < 4) {
+        cout << "Usage: train <records> <out.nnue> [epochs] [threads]" << newline;
+        return 1;
+    }
+    // A missing, empty or truncated file would otherwise export an untrained network
+    uint64_t inputRecords = 0;
+    if (!recordFileCount(argv[2], inputRecords) || inputRecords == 0) {
+        cout << "Not a record file: " << argv[2] << newline;
+        return 1;
+    }
+
+    TrainerConfig config;
+    if (argc > 4) config.epochs = std::max(1, std::atoi(argv[4]));
+    config.threads = (argc > 5) ? std::max(1, std::atoi(argv[5])) : std::max(1u, std::thread::hardware_concurrency());
+#ifdef __AVX2__
+    cout << "Training with AVX2 kernels, " << config.threads << " threads" << newline;
+#else
+    cout << "Training with scalar kernels (build with -mavx2 for SIMD), " << config.threads << " threads" << newline;
+#endif
+
+    std::vector<float> params;
+    if (!trainNnue(argv[2], config, params)) {
+        cout << "Could not read " << argv[2] << newline;
+        return 1;
+    }
+    if (!exportNnue(params, argv[3]) || !nnue.load(argv[3])) {
+        cout << "Could not write " << argv[3] << newline;
+        return 1;
+    }
+
+    // Quantization error over the first records of the training file
+    FILE* file = std::fopen(argv[2], "rb");
+    std::vector<PositionRecord> sample(1000);
+    size_t count = file ? std::fread(sample.data(), sizeof(PositionRecord), sample.size(), file) : 0;
+    if (file) std::fclose(file);
+    double errorSum = 0;
+    for (size_t i = 0; i < count; i++) {
+        alignas(32) float acc[2][NnueHidden];
+        int features[2][32];
+        int counts[2];
+        float exact = trainerForward(sample[i], params.data(), acc, features, counts) * NnueScale;
+        ChessBoard board;
+        bool isWhitesTurn = true;
+        board.loadFen(recordFen(sample[i]), isWhitesTurn);
+        errorSum += std::abs(exact - nnue.evaluate(board, isWhitesTurn ? Piece::White : Piece::Black));
+    }
+    cout << "Wrote " << argv[3] << ", mean quantization error " << errorSum / std::max<size_t>(count, 1) << " cp over " << count << " positions" << newline;
+    return 0;
+}
+
+// --- PGN ---
+// Streaming reader for PGN archives and SAN conversion. Comments, variations and NAGs are skipped.
+// Castling, promotion and en passant do not exist in this game, a SAN move that needs them does
+// not parse and the caller stops following that game there.
+
+struct PgnGame {
+    std::vector<std::pair<std::string, std::string>> tags; // In file order
+    std::vector<std::string> moves; // SAN, as written
+    std::string result;
+
+    const std::string* tag(const std::string& name) const {
+        for (const auto& t : tags) if (t.first == name) return &t.second;
+        return nullptr;
+    }
+};
+
+class PgnReader {
+public:
+    explicit PgnReader(FILE* input) : file(input) {}
+
+    // Reads the next game with at least one move or a result, false at the end of the input
+    bool next(PgnGame& game) {
+        game = PgnGame{};
+        int ch;
+        while ((ch = std::getc(file)) != EOF) {
+            if (ch == '[') {
+                // A tag after movetext starts the next game (the previous one had no result)
+                if (!game.moves.empty()) {
+                    std::ungetc(ch, file);
+                    return true;
+                }
+                readTag(game);
+            }
+            else if (ch == '{') skipUntil('}');
+            else if (ch == ';') skipUntil('\n');
+            else if (ch == '(') skipVariation();
+            else if (!std::isspace(ch)) {
+                std::string token(1, (char)ch);
+                while ((ch = std::getc(file)) != EOF && !std::isspace(ch) && !std::strchr("{;()[", ch)) token += (char)ch;
+                if (ch != EOF) std::ungetc(ch, file);
+                if (token == "1-0" || token == "0-1" || token == "1/2-1/2" || token == "*") {
+                    game.result = token;
+                    return true;
+                }
+                if (token[0] == '$') continue; // NAG
+                size_t start = token.find_first_not_of("0123456789."); // Move numbers, also "12.e4"
+                if (start != std::string::npos) game.moves.push_back(token.substr(start));
+            }
+        }
+        return !game.moves.empty();
+    }
+
+private:
+    FILE* file;
+
+    void skipUntil(int end) {
+        int ch;
+        while ((ch = std::getc(file)) != EOF && ch != end) {}
+    }
+
+    void skipVariation() {
+        int depth = 1, ch;
+        while (depth > 0 && (ch = std::getc(file)) != EOF) {
+            if (ch == '(') depth++;
+            else if (ch == ')') depth--;
+            else if (ch == '{') skipUntil('}');
+        }
+    }
+
+    void readTag(PgnGame& game) {
+        std::string line;
+        int ch;
+        while ((ch = std::getc(file)) != EOF && ch != ']') {
+            if (ch == '"') {
+                line += (char)ch;
+                while ((ch = std::getc(file)) != EOF && ch != '"') {
+                    if (ch == '\\') ch = std::getc(file);
+                    line += (char)ch;
+                }
+            }
+            line += (char)ch;
+        }
+        size_t space = line.find(' ');
+        size_t open = line.find('"');
+        if (space == std::string::npos || open == std::string::npos) return;
+        size_t close = line.rfind('"');
+        game.tags.emplace_back(line.substr(0, space), (close > open) ? line.substr(open + 1, close - open - 1) : "");
+    }
+};
+
+// Finds the legal move 'san' describes, false if none or more than one does
+bool parseSan(ChessBoard& board, uint8_t color, std::string san, Move& out) {
+    while (!san.empty() && std::strchr("+#!?", san.back())) san.pop_back();
+    if (san.size() < 2 || san.find('=') != std::string::npos || san[0] == 'O' || san[0] == '0') return false;
+
+    static const std::string pieceLetters = "PNBRQK";
+    uint8_t type = Piece::Pawn;
+    size_t i = 0;
+    if (pieceLetters.find(san[0]) != std::string::npos) type = (uint8_t)(pieceLetters.find(san[i++]) + 1);
+    char toFile = san[san.size() - 2], toRank = san[san.size() - 1];
+    if (toFile < 'a' || toFile > 'h' || toRank < '1' || toRank > '8') return false;
+    int to = ('8' - toRank) * 8 + (toFile - 'a');
+    int fromFile = -1, fromRank = -1;
+    for (; i + 2 < san.size(); i++) {
+        if (san[i] >= 'a' && san[i] <= 'h') fromFile = san[i] - 'a';
+        else if (san[i] >= '1' && san[i] <= '8') fromRank = '8' - san[i];
+        else if (san[i] != 'x' && san[i] != '-') return false;
+    }
+
+    std::vector<Move> moves;
+    board.generateMoves(color, moves);
+    int found = 0;
+    for (const Move& m : moves) {
+        if (m.to != to || (board.pieceAt(m.from / 8, m.from % 8) & typeMask) != type) continue;
+        if ((fromFile >= 0 && m.from % 8 != fromFile) || (fromRank >= 0 && m.from / 8 != fromRank)) continue;
+        out = m;
+        found++;
+    }
+    return found == 1;
+}
+
+// Standard algebraic notation of a legal move, with '+' or '#'
+std::string toSan(ChessBoard& board, uint8_t color, const Move& m) {
+    static const char pieceLetters[] = " PNBRQK";
+    uint8_t type = board.pieceAt(m.from / 8, m.from % 8) & typeMask;
+    auto fileOf = [](int sq) { return (char)('a' + sq % 8); };
+    auto rankOf = [](int sq) { return (char)('8' - sq / 8); };
+
+    std::vector<Move> moves;
+    board.generateMoves(color, moves);
+    std::string san;
+    if (type == Piece::Pawn) {
+        if (m.captured != Piece::None) san += fileOf(m.from);
+    }
+    else {
+        san += pieceLetters[type];
+        bool ambiguous = false, sameFile = false, sameRank = false;
+        for (const Move& other : moves) {
+            if (other.to != m.to || other.from == m.from || (board.pieceAt(other.from / 8, other.from % 8) & typeMask) != type) continue;
+            ambiguous = true;
+            sameFile |= other.from % 8 == m.from % 8;
+            sameRank |= other.from / 8 == m.from / 8;
+        }
+        if (ambiguous && !sameFile) san += fileOf(m.from);
+        else if (ambiguous && !sameRank) san += rankOf(m.from);
+        else if (ambiguous) { san += fileOf(m.from); san += rankOf(m.from); }
+    }
+    if (m.captured != Piece::None) san += 'x';
+    san += fileOf(m.to);
+    san += rankOf(m.to);
+
+    uint8_t enemy = opposite(color);
+    board.doMove(m);
+    if (board.isInCheck(enemy)) {
+        std::vector<Move> replies;
+        board.generateMoves(enemy, replies);
+        san += replies.empty() ? '#' : '+';
+    }
+    board.undoMove(m);
+    return san;
+}
+
+// --- Puzzle Mining ---
+// Each position of a game gets a cheap search. When the side to move's score jumps by 'swing' over
+// what the previous mover expected and is winning, the previous move was a mistake with a punishing
+// reply. A deeper two-line MultiPV search keeps only positions where that reply is the single
+// winning move. Games are processed in parallel, one per worker.
+
+struct PuzzleConfig {
+    int scanDepth = 3;
+    int verifyDepth = 6;
+    uint64_t scanNodes = 1500; // Node caps keep a sharp position from stalling its worker
+    uint64_t verifyNodes = 100000;
+    int swing = 200;
+    int winning = 150;       // Minimum verified score of the solution
+    int uniqueMargin = 150;  // The second best move must be at least this much worse
+    int solutionPlies = 5;
+};
+
+constexpr size_t puzzleHashMB = 4;
+
+struct PuzzleStats {
+    uint64_t games = 0;
+    uint64_t positions = 0;
+    uint64_t candidates = 0;
+    uint64_t puzzles = 0;
+    uint64_t stoppedGames = 0; // Games left early at a move this game's rules cannot play
+};
+
+// Appends "fen;solution;score" lines for the puzzles found in 'game'
+void minePuzzles(const PgnGame& game, const PuzzleConfig& config, TranspositionTable& table, std::vector<std::string>& out, PuzzleStats& stats) {
+    ChessBoard board;
+    bool isWhitesTurn = true;
+    const std::string* fen = game.tag("FEN");
+    if (fen && !board.loadFen(*fen, isWhitesTurn)) return;
+    table.clear();
+    stats.games++;
+
+    Search scan(board, isWhitesTurn, table);
+    scan.nodeLimit = config.scanNodes;
+    Search verify(board, isWhitesTurn, table);
+    verify.multiPV = 2;
+    verify.nodeLimit = config.verifyNodes;
+    bool havePrevious = false;
+    int previousScore = 0;
+    for (const std::string& san : game.moves) {
+        uint8_t color = isWhitesTurn ? Piece::White : Piece::Black;
+        Move played;
+        if (!parseSan(board, color, san, played)) {
+            stats.stoppedGames++;
+            return;
+        }
+
+        scan.reset(board, isWhitesTurn);
+        int score = scan.run(config.scanDepth).score;
+        stats.positions++;
+        if (havePrevious && previousScore + score >= config.swing && score >= config.winning) {
+            stats.candidates++;
+            verify.reset(board, isWhitesTurn);
+            SearchResult result = verify.run(config.verifyDepth);
+            bool unique = result.lines.size() == 1 || result.lines[0].score - result.lines[1].score >= config.uniqueMargin;
+            if (!result.lines.empty() && result.lines[0].score >= config.winning && unique) {
+                std::string line = board.toFen(isWhitesTurn) + ";";
+                ChessBoard replay = board;
+                uint8_t side = color;
+                const std::vector<Move>& pv = result.lines[0].moves;
+                for (int i = 0; i < (int)pv.size() && i < config.solutionPlies; i++) {
+                    line += (i ? " " : "") + toSan(replay, side, pv[i]);
+                    replay.doMove(pv[i]);
+                    side = opposite(side);
+                }
+                out.push_back(line + ";" + std::to_string(result.lines[0].score));
+                stats.puzzles++;
+            }
+        }
+        havePrevious = true;
+        previousScore = score;
+        board.doMove(played);
+        isWhitesTurn = !isWhitesTurn;
+    }
+}
+
+// Usage: chess puzzles <pgn> [out] [threads]
+// Writes one "fen;solution;score" line per puzzle to 'out' (default stdout)
+int runPuzzles(int argc, char* argv[]) {
+    if (argc < 3) {
+        cout << "Usage: puzzles <pgn> [out] [threads]" << newline;
+        return 1;
+    }
+    FILE* input = std::fopen(argv[2], "r");
+    if (!input) {
+        cout << "Could not open " << argv[2] << newline;
+        return 1;
+    }
+    FILE* output = (argc > 3) ? std::fopen(argv[3], "w") : stdout;
+    if (!output) {
+        cout << "Could not open " << argv[3] << newline;
+        std::fclose(input);
+        return 1;
+    }
+    int threads = (argc > 4) ? std::max(1, std::atoi(argv[4])) : std::max(1u, std::thread::hardware_concurrency());
+
+    PuzzleConfig config;
+    PgnReader reader(input);
+    std::mutex inputMutex, outputMutex;
+    PuzzleStats total;
+    auto worker = [&]() {
+        TranspositionTable table;
+        table.resize(puzzleHashMB);
+        PuzzleStats stats;
+        PgnGame game;
+        std::vector<std::string> lines;
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(inputMutex);
+                if (!reader.next(game)) break;
+            }
+            minePuzzles(game, config, table, lines, stats);
+            if (lines.empty()) continue;
+            std::lock_guard<std::mutex> lock(outputMutex);
+            for (const std::string& line : lines) std::fprintf(output, "%s\n", line.c_str());
+            lines.clear();
+        }
+        std::lock_guard<std::mutex> lock(outputMutex);
+        total.games += stats.games;
+        total.positions += stats.positions;
+        total.candidates += stats.candidates;
+        total.puzzles += stats.puzzles;
+        total.stoppedGames += stats.stoppedGames;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) workers.emplace_back(worker);
+    for (std::thread& w : workers) w.join();
+    double minutes = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / 60;
+    std::fclose(input);
+    if (output != stdout) std::fclose(output);
+
+    std::fprintf(stderr, "Games: %llu (%llu stopped at castling, promotion or en passant), positions: %llu\n",
+        (unsigned long long)total.games, (unsigned long long)total.stoppedGames, (unsigned long long)total.positions);
+    std::fprintf(stderr, "Candidates: %llu, puzzles: %llu\n", (unsigned long long)total.candidates, (unsigned long long)total.puzzles);
+    std::fprintf(stderr, "Games/min: %.0f, per core: %.0f\n", total.games / minutes, total.games / minutes / threads);
+    return 0;
+}
+
+// --- Game Annotation ---
+// Every position of a game is searched to a fixed node budget, positions are handed out to
+// threads one at a time. Each search starts from a cleared table, so the annotations do not
+// depend on the thread count. A move's loss is the mover's score before it minus the score after.
+
+struct AnnotateConfig {
+    uint64_t nodes = 20000;
+    int inaccuracy = 50; // Centipawns lost for "?!", "?" and "??"
+    int mistake = 100;
+    int blunder = 300;
+};
+
+constexpr size_t annotateHashMB = 1;
+
+struct PositionAnalysis {
+    int score = 0; // Side to move's view
+    Move best;
+    bool hasMoves = false;
+};
+
+// "[%eval ...]" value from White's view: pawns, or "#n" for a mate in n moves
+std::string evalString(int score, bool isWhitesTurn) {
+    int white = isWhitesTurn ? score : -score;
+    if (std::abs(white) >= MateScore - MaxPly) {
+        int moves = (MateScore - std::abs(white) + 1) / 2;
+        return (white > 0 ? "#" : "#-") + std::to_string(moves);
+    }
+    char text[16];
+    std::snprintf(text, sizeof(text), "%.2f", white / 100.0);
+    return text;
+}
+
+// Writes 'game' with an eval comment on every playable move, and a glyph plus the best move on
+// moves that lose enough. Moves after one this game's rules cannot play are copied unannotated.
+std::string annotateGame(const PgnGame& game, const AnnotateConfig& config, std::vector<std::unique_ptr<TranspositionTable>>& tables,
+    uint64_t& positionsSearched) {
+    ChessBoard board;
+    bool isWhitesTurn = true;
+    const std::string* fen = game.tag("FEN");
+    if (fen && !board.loadFen(*fen, isWhitesTurn)) return ""; // Skipped like the puzzle miner and book builder do
+    const bool whiteStarts = isWhitesTurn;
+
+    // Positions before each playable move, plus the one after the last
+    std::vector<ChessBoard> positions = { board };
+    std::vector<Move> played;
+    for (const std::string& san : game.moves) {
+        Move m;
+        if (!parseSan(board, isWhitesTurn ? Piece::White : Piece::Black, san, m)) break;
+        board.doMove(m);
+        isWhitesTurn = !isWhitesTurn;
+        played.push_back(m);
+        positions.push_back(board);
+    }
+
+    std::vector<PositionAnalysis> analysis(positions.size());
+    std::atomic<size_t> next{ 0 };
+    auto worker = [&](size_t t) {
+        Search search(positions[0], whiteStarts, *tables[t]);
+        search.nodeLimit = config.nodes;
+        for (size_t i = next++; i < positions.size(); i = next++) {
+            bool white = (i % 2 == 0) == whiteStarts;
+            std::vector<Move> moves;
+            positions[i].generateMoves(white ? Piece::White : Piece::Black, moves);
+            if (moves.empty()) continue;
+            tables[t]->clear();
+            search.reset(positions[i], white);
+            SearchResult result = search.run(MaxPly / 2);
+            analysis[i] = { result.score, result.best, true };
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < tables.size(); t++) workers.emplace_back(worker, t);
+    worker(0);
+    for (std::thread& w : workers) w.join();
+    positionsSearched += positions.size();
+
+    std::string text;
+    for (const auto& [name, value] : game.tags) text += "[" + name + " \"" + value + "\"]\n";
+    text += "[Annotator \"" + std::to_string(config.nodes) + " nodes per position\"]\n\n";
+
+    std::string line;
+    auto append = [&](const std::string& token) {
+        if (!line.empty() && line.size() + 1 + token.size() > 79) {
+            text += line + "\n";
+            line.clear();
+        }
+        line += (line.empty() ? "" : " ") + token;
+    };
+
+    isWhitesTurn = whiteStarts;
+    for (size_t i = 0; i < game.moves.size(); i++) {
+        // The move number stays on the same line as its move
+        int moveNumber = (int)(i + (whiteStarts ? 0 : 1)) / 2 + 1;
+        std::string prefix = isWhitesTurn ? std::to_string(moveNumber) + ". " : (i == 0) ? std::to_string(moveNumber) + "... " : "";
+
+        if (i >= played.size()) {
+            append(prefix + game.moves[i]);
+            isWhitesTurn = !isWhitesTurn;
+            continue;
+        }
+        uint8_t color = isWhitesTurn ? Piece::White : Piece::Black;
+        const PositionAnalysis& before = analysis[i];
+        const PositionAnalysis& after = analysis[i + 1];
+        // A mated or stalemated opponent has no search, the move itself decides the result
+        bool mates = !after.hasMoves && positions[i + 1].isInCheck(opposite(color));
+        int afterScore = after.hasMoves ? -after.score : (mates ? MateScore - 1 : 0);
+        int loss = before.score - afterScore;
+
+        ChessBoard position = positions[i];
+        std::string san = toSan(position, color, played[i]);
+        std::string comment = "{[%eval " + evalString(afterScore, isWhitesTurn) + "]";
+        if (!sameMove(played[i], before.best) && loss >= config.inaccuracy) {
+            san += (loss >= config.blunder) ? "??" : (loss >= config.mistake) ? "?" : "?!";
+            comment += " Best was " + toSan(position, color, before.best) + " " + evalString(before.score, isWhitesTurn);
+        }
+        append(prefix + san);
+        if (!mates) append(comment + "}");
+        isWhitesTurn = !isWhitesTurn;
+    }
+    append(game.result.empty() ? "*" : game.result);
+    return text + line + "\n\n";
+}
+
+// Usage: chess annotate <pgn> [out] [threads] [nodes]
+// Writes the annotated games to 'out' (default stdout)
+int runAnnotate(int argc, char* argv[]) {
+    if (argc < 3) {
+        cout << "Usage: annotate <pgn> [out] [threads] [nodes]" << newline;
+        return 1;
+    }
+    FILE* input = std::fopen(argv[2], "r");
+    if (!input) {
+        cout << "Could not open " << argv[2] << newline;
+        return 1;
+    }
+    FILE* output = (argc > 3) ? std::fopen(argv[3], "w") : stdout;
+    if (!output) {
+        cout << "Could not open " << argv[3] << newline;
+        std::fclose(input);
+        return 1;
+    }
+    int threads = (argc > 4) ? std::max(1, std::atoi(argv[4])) : std::max(1u, std::thread::hardware_concurrency());
+    AnnotateConfig config;
+    if (argc > 5) config.nodes = std::max(1, std::atoi(argv[5]));
+
+    std::vector<std::unique_ptr<TranspositionTable>> tables;
+    for (int t = 0; t < threads; t++) {
+        tables.push_back(std::make_unique<TranspositionTable>());
+        tables.back()->resize(annotateHashMB);
+    }
+
+    PgnReader reader(input);
+    PgnGame game;
+    uint64_t games = 0, skipped = 0, positions = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (reader.next(game)) {
+        std::string annotated = annotateGame(game, config, tables, positions);
+        if (annotated.empty()) { skipped++; continue; }
+        std::fputs(annotated.c_str(), output);
+        games++;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::fclose(input);
+    if (output != stdout) std::fclose(output);
+
+    std::fprintf(stderr, "Games: %llu (%llu skipped, bad FEN), positions: %llu, threads: %d, nodes per position: %llu\n",
+        (unsigned long long)games, (unsigned long long)skipped, (unsigned long long)positions, threads, (unsigned long long)config.nodes);
+    std::fprintf(stderr, "Time: %.1f s, positions/s: %.0f\n", seconds, positions / seconds);
+    return 0;
+}
+
+// --- Opening Explorer ---
+// Per-position move statistics from PGN archives. The builder counts every (position, move) pair
+// of the first plies of each game in a hash map, then writes the entries sorted by position key.
+// Readers map that file and binary search it, so a query is O(log n) without loading the book.
+
+struct BookEntry {
+    uint64_t key;       // Position, with the side to move
+    uint64_t ratingSum; // Mover's rating, over 'ratedGames'
+    uint32_t games;
+    uint32_t wins;      // From the mover's view
+    uint32_t draws;
+    uint32_t ratedGames;
+    uint8_t from;
+    uint8_t to;
+    uint8_t padding[6];
+};
+static_assert(sizeof(BookEntry) == 40, "Book entries are written to disk as is");
+
+struct BookFileHeader {
+    char magic[8] = { 'C', 'H', 'E', 'S', 'S', 'B', 'K', '1' };
+    uint32_t formatVersion = 1;
+    uint32_t entrySize = sizeof(BookEntry);
+    uint64_t zobristFingerprint = 0;
+    uint64_t entryCount = 0;
+};
+
+class OpeningBook {
+public:
+    OpeningBook() {
+        memoryHandle = memoryRegistry.add("Opening book", [this]() {
+            size_t bytes = count * sizeof(BookEntry);
+            return MemoryUsage{ bytes, 0 }; // Mapped, pages are only read in by queries
+        });
+    }
+
+    ~OpeningBook() {
+        close();
+        memoryRegistry.remove(memoryHandle);
+    }
+
+    OpeningBook(const OpeningBook&) = delete;
+    OpeningBook& operator=(const OpeningBook&) = delete;
+
+    bool load(const std::string& path) {
+        close();
+        BookFileHeader expected, header;
+#ifdef __linux__
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(header)) { ::close(fd); return false; }
+        mappedSize = (size_t)info.st_size;
+        mapped = mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) { mapped = nullptr; return false; }
+        std::memcpy(&header, mapped, sizeof(header));
+        entries = (const BookEntry*)((const char*)mapped + sizeof(header));
+        bool sized = mappedSize == sizeof(header) + header.entryCount * sizeof(BookEntry);
+#else
+        FILE* file = std::fopen(path.c_str(), "rb");
+        if (!file) return false;
+        bool sized = std::fread(&header, sizeof(header), 1, file) == 1;
+        if (sized && header.entryCount < (1ull << 32)) {
+            storage.resize(header.entryCount);
+            sized = std::fread(storage.data(), sizeof(BookEntry), storage.size(), file) == storage.size();
+        }
+        std::fclose(file);
+        entries = storage.data();
+#endif
+        if (!sized || !std::equal(header.magic, header.magic + 8, expected.magic) || header.formatVersion != expected.formatVersion
+            || header.entrySize != expected.entrySize || header.zobristFingerprint != zobrist.fingerprint()) {
+            close();
+            return false;
+        }
+        count = header.entryCount;
+        return true;
+    }
+
+    bool loaded() const { return count > 0; }
+
+    // Moves played from position 'key', most played first
+    std::vector<BookEntry> lookup(uint64_t key) const {
+        const BookEntry* first = std::lower_bound(entries, entries + count, key, [](const BookEntry& e, uint64_t k) { return e.key < k; });
+        const BookEntry* last = first;
+        while (last != entries + count && last->key == key) last++;
+        return std::vector<BookEntry>(first, last);
+    }
+
+private:
+    const BookEntry* entries = nullptr;
+    size_t count = 0;
+    int memoryHandle = 0;
+    void* mapped = nullptr;
+    size_t mappedSize = 0;
+    std::vector<BookEntry> storage;
+
+    void close() {
+#ifdef __linux__
+        if (mapped) munmap(mapped, mappedSize);
+#endif
+        mapped = nullptr;
+        storage.clear();
+        entries = nullptr;
+        count = 0;
+    }
+};
+
+OpeningBook openingBook;
+
+// Book moves for the interactive game, printed under the board at the start of each turn
+void printBookMoves(const ChessBoard& position, bool isWhitesTurn) {
+    uint64_t key = position.hashKey() ^ (isWhitesTurn ? 0 : zobrist.blackToMove);
+    std::vector<BookEntry> moves = openingBook.lookup(key);
+    if (moves.empty()) {
+        cout << "\nBook: no games from this position" << newline;
+        return;
+    }
+    uint64_t total = 0;
+    for (const BookEntry& e : moves) total += e.games;
+    std::printf("\nBook: %llu games\n  Move      Games    Share   Score  Avg rating\n", (unsigned long long)total);
+    ChessBoard board = position;
+    uint8_t color = isWhitesTurn ? Piece::White : Piece::Black;
+    for (size_t i = 0; i < moves.size() && i < 8; i++) {
+        const BookEntry& e = moves[i];
+        Move m = { e.from, e.to, board.pieceAt(e.to / 8, e.to % 8) };
+        std::string rating = e.ratedGames ? std::to_string(e.ratingSum / e.ratedGames) : "-";
+        std::printf("  %-8s %6u  %6.1f%%  %5.1f%%  %10s\n", toSan(board, color, m).c_str(), e.games, 100.0 * e.games / total,
+            100.0 * (e.wins + 0.5 * e.draws) / e.games, rating.c_str());
+    }
+    std::fflush(stdout);
+}
+
+// Usage: chess book <out.book> <pgn> [pgn ...] [--plies N]
+// Counts the first N plies (default 30) of every game
+int runBookBuild(int argc, char* argv[]) {
+    std::vector<std::string> inputs;
+    std::string outPath;
+    int maxPlies = 30;
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--plies" && i + 1 < argc) maxPlies = std::max(1, std::atoi(argv[++i]));
+        else if (outPath.empty()) outPath = arg;
+        else inputs.push_back(arg);
+    }
+    if (outPath.empty() || inputs.empty()) {
+        cout << "Usage: book <out.book> <pgn> [pgn ...] [--plies N]" << newline;
+        return 1;
+    }
+
+    struct PositionMove {
+        uint64_t key;
+        uint16_t move;
+        bool operator==(const PositionMove& o) const { return key == o.key && move == o.move; }
+    };
+    struct PositionMoveHash {
+        size_t operator()(const PositionMove& p) const { return (size_t)(p.key ^ (p.move * 0x9E3779B97F4A7C15ull)); }
+    };
+    std::unordered_map<PositionMove, BookEntry, PositionMoveHash> stats;
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t games = 0, positions = 0;
+    for (const std::string& path : inputs) {
+        FILE* input = std::fopen(path.c_str(), "r");
+        if (!input) {
+            cout << "Could not open " << path << newline;
+            return 1;
+        }
+        PgnReader reader(input);
+        PgnGame game;
+        while (reader.next(game)) {
+            int whiteResult = (game.result == "1-0") ? 1 : (game.result == "0-1") ? -1 : (game.result == "1/2-1/2") ? 0 : 2;
+            if (whiteResult == 2) continue; // Unfinished games say nothing about the moves
+            const std::string* whiteElo = game.tag("WhiteElo");
+            const std::string* blackElo = game.tag("BlackElo");
+            int ratings[2] = { whiteElo ? std::atoi(whiteElo->c_str()) : 0, blackElo ? std::atoi(blackElo->c_str()) : 0 };
+
+            ChessBoard board;
+            bool isWhitesTurn = true;
+            const std::string* fen = game.tag("FEN");
+            if (fen && !board.loadFen(*fen, isWhitesTurn)) continue;
+            games++;
+            for (int ply = 0; ply < maxPlies && ply < (int)game.moves.size(); ply++) {
+                Move m;
+                if (!parseSan(board, isWhitesTurn ? Piece::White : Piece::Black, game.moves[ply], m)) break;
+                uint64_t key = board.hashKey() ^ (isWhitesTurn ? 0 : zobrist.blackToMove);
+                BookEntry& e = stats[{ key, (uint16_t)(m.from << 8 | m.to) }];
+                int result = isWhitesTurn ? whiteResult : -whiteResult;
+                int rating = ratings[isWhitesTurn ? 0 : 1];
+                e.key = key;
+                e.from = m.from;
+                e.to = m.to;
+                e.games++;
+                e.wins += result > 0;
+                e.draws += result == 0;
+                if (rating > 0) { e.ratingSum += rating; e.ratedGames++; }
+                positions++;
+                board.doMove(m);
+                isWhitesTurn = !isWhitesTurn;
+            }
+        }
+        std::fclose(input);
+    }
+
+    std::vector<BookEntry> entries;
+    entries.reserve(stats.size());
+    for (const auto& [position, entry] : stats) entries.push_back(entry);
+    stats.clear();
+    std::sort(entries.begin(), entries.end(), [](const BookEntry& a, const BookEntry& b) {
+        if (a.key != b.key) return a.key < b.key;
+        if (a.games != b.games) return a.games > b.games;
+        return (a.from << 8 | a.to) < (b.from << 8 | b.to);
+    });
+
+    BookFileHeader header;
+    header.zobristFingerprint = zobrist.fingerprint();
+    header.entryCount = entries.size();
+    FILE* out = std::fopen(outPath.c_str(), "wb");
+    bool ok = out && std::fwrite(&header, sizeof(header), 1, out) == 1
+        && std::fwrite(entries.data(), sizeof(BookEntry), entries.size(), out) == entries.size();
+    if (out) ok = (std::fclose(out) == 0) && ok;
+    if (!ok) {
+        cout << "Could not write " << outPath << newline;
+        return 1;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    cout << "Games: " << games << ", moves counted: " << positions << ", book entries: " << entries.size()
+        << " (" << entries.size() * sizeof(BookEntry) / 1024 << " KiB)" << newline;
+    cout << "Time: " << (long long)(seconds * 1000) << " ms, " << (uint64_t)(games / seconds) << " games/s" << newline;
+    return 0;
+}
+
+// --- Board Backends ---
+// The same perft and search code instantiated over three board representations, so they can be
+// compared on equal terms. A backend is any class with:
+//   static constexpr const char* name;
+//   void load(const ChessBoard& source);
+//   uint8_t pieceAt(int sq) const;                             // sq = row * 8 + col
+//   void generateMoves(uint8_t color, std::vector<Move>& moves); // Legal moves only
+//   void doMove(const Move& m);  void undoMove(const Move& m);
+//   bool isInCheck(uint8_t color) const;
+// All three follow the game's rules (no castling, en passant or promotion), so their perft counts agree.
+
+// The engine's own 8x8 array, through ChessBoard (which also keeps the Zobrist hash up to date)
+class ArrayBoard {
+public:
+    static constexpr const char* name = "8x8 array";
+
+    void load(const ChessBoard& source) { board = source; }
+    uint8_t pieceAt(int sq) const { return board.pieceAt(sq / 8, sq % 8); }
+    void generateMoves(uint8_t color, std::vector<Move>& moves) { board.generateMoves(color, moves); }
+    void doMove(const Move& m) { board.doMove(m); }
+    void undoMove(const Move& m) { board.undoMove(m); }
+    bool isInCheck(uint8_t color) const { return board.isInCheck(color); }
+
+private:
+    ChessBoard board;
+};
+
+// 16x8 mailbox: a square is off the board exactly when index & 0x88 is set, which also catches
+// wrap-around past the a- and h-files, so rays need no separate bounds checks
+class Mailbox0x88 {
+public:
+    static constexpr const char* name = "0x88 mailbox";
+
+    void load(const ChessBoard& source) {
+        squares.fill(Piece::None);
+        kingSquare = { -1, -1 };
+        for (int sq = 0; sq < 64; sq++) {
+            uint8_t p = source.pieceAt(sq / 8, sq % 8);
+            squares[to88(sq)] = p;
+            if ((p & typeMask) == Piece::King) kingSquare[sideIndex(p & colorMask)] = to88(sq);
+        }
+    }
+
+    uint8_t pieceAt(int sq) const { return squares[to88(sq)]; }
+
+    void generateMoves(uint8_t color, std::vector<Move>& moves) {
+        for (int s = 0; s < 128; s++) {
+            if (s & 0x88) { s += 7; continue; }
+            uint8_t p = squares[s];
+            if (p == Piece::None || (p & colorMask) != color) continue;
+            switch (p & typeMask) {
+            case Piece::Pawn: {
+                int forward = (color == Piece::White) ? -16 : 16;
+                int t = s + forward;
+                if (t & 0x88) break;
+                if (squares[t] == Piece::None) {
+                    tryAddMove(s, t, color, moves);
+                    int startRow = (color == Piece::White) ? 6 : 1;
+                    if ((s >> 4) == startRow && squares[t + forward] == Piece::None) tryAddMove(s, t + forward, color, moves);
+                }
+                if (!((t - 1) & 0x88) && isEnemy(squares[t - 1], color)) tryAddMove(s, t - 1, color, moves);
+                if (!((t + 1) & 0x88) && isEnemy(squares[t + 1], color)) tryAddMove(s, t + 1, color, moves);
+                break;
+            }
+            case Piece::Knight:
+            case Piece::King: {
+                const int* offsets = ((p & typeMask) == Piece::Knight) ? knightOffsets : kingOffsets;
+                for (int i = 0; i < 8; i++) {
+                    int t = s + offsets[i];
+                    if (!(t & 0x88) && (squares[t] == Piece::None || isEnemy(squares[t], color))) tryAddMove(s, t, color, moves);
+                }
+                break;
+            }
+            default: {
+                uint8_t type = p & typeMask;
+                int first = (type == Piece::Bishop) ? 4 : 0;
+                int last = (type == Piece::Rook) ? 4 : 8;
+                for (int d = first; d < last; d++) {
+                    for (int t = s + kingOffsets[sliderOrder[d]]; !(t & 0x88); t += kingOffsets[sliderOrder[d]]) {
+                        if (squares[t] == Piece::None) { tryAddMove(s, t, color, moves); continue; }
+                        if (isEnemy(squares[t], color)) tryAddMove(s, t, color, moves);
+                        break;
+                    }
+                }
+                break;
+            }
+            }
+        }
+    }
+
+    void doMove(const Move& m) { movePiece(to88(m.from), to88(m.to)); }
+    void undoMove(const Move& m) { unmovePiece(to88(m.from), to88(m.to), m.captured); }
+
+    bool isInCheck(uint8_t color) const {
+        return isAttacked(kingSquare[sideIndex(color)], opposite(color));
+    }
+
+private:
+    std::array<uint8_t, 128> squares;
+    std::array<int, 2> kingSquare;
+
+    static constexpr int knightOffsets[8] = { -33, -31, -18, -14, 14, 18, 31, 33 };
+    static constexpr int kingOffsets[8] = { -17, -16, -15, -1, 1, 15, 16, 17 };
+    static constexpr int sliderOrder[8] = { 1, 6, 3, 4, 0, 2, 5, 7 }; // Straight directions first
+
+    static int to88(int sq) { return (sq >> 3) * 16 + (sq & 7); }
+    static int from88(int s) { return (s >> 4) * 8 + (s & 7); }
+    static bool isEnemy(uint8_t p, uint8_t color) { return p != Piece::None && (p & colorMask) != color; }
+
+    void movePiece(int from, int to) {
+        uint8_t piece = squares[from];
+        squares[to] = piece;
+        squares[from] = Piece::None;
+        if ((piece & typeMask) == Piece::King) kingSquare[sideIndex(piece & colorMask)] = to;
+    }
+
+    void unmovePiece(int from, int to, uint8_t captured) {
+        uint8_t piece = squares[to];
+        squares[from] = piece;
+        squares[to] = captured;
+        if ((piece & typeMask) == Piece::King) kingSquare[sideIndex(piece & colorMask)] = from;
+    }
+
+    void tryAddMove(int from, int to, uint8_t color, std::vector<Move>& moves) {
+        uint8_t captured = squares[to];
+        movePiece(from, to);
+        bool safe = !isAttacked(kingSquare[sideIndex(color)], opposite(color));
+        unmovePiece(from, to, captured);
+        if (safe) moves.push_back({ (uint8_t)from88(from), (uint8_t)from88(to), captured });
+    }
+
+    bool isAttacked(int s, uint8_t by) const {
+        if (s < 0) return false;
+        // A White pawn attacking s stands one row below it (+16), a Black one a row above
+        int pawnRow = (by == Piece::White) ? 16 : -16;
+        for (int t : { s + pawnRow - 1, s + pawnRow + 1 })
+            if (!(t & 0x88) && squares[t] == (Piece::Pawn | by)) return true;
+        for (int i = 0; i < 8; i++) {
+            int t = s + knightOffsets[i];
+            if (!(t & 0x88) && squares[t] == (Piece::Knight | by)) return true;
+            t = s + kingOffsets[i];
+            if (!(t & 0x88) && squares[t] == (Piece::King | by)) return true;
+        }
+        for (int d = 0; d < 8; d++) {
+            int step = kingOffsets[sliderOrder[d]];
+            for (int t = s + step; !(t & 0x88); t += step) {
+                uint8_t p = squares[t];
+                if (p == Piece::None) continue;
+                uint8_t type = p & typeMask;
+                if ((p & colorMask) == by && (type == Piece::Queen || type == (d < 4 ? Piece::Rook : Piece::Bishop))) return true;
+                break;
+            }
+        }
+        return false;
+    }
+};
+
+// Knight, King and pawn attack sets per square
+struct LeaperTables {
+    std::array<uint64_t, 64> knight, king;
+    std::array<std::array<uint64_t, 64>, 2> pawn; // [side][sq], squares a pawn of that side attacks
+
+    LeaperTables() {
+        static const int knightMoves[8][2] = { {-2,-1}, {-2,1}, {-1,-2}, {-1,2}, {1,-2}, {1,2}, {2,-1}, {2,1} };
+        static const int kingMoves[8][2] = { {-1,-1}, {-1,0}, {-1,1}, {0,-1}, {0,1}, {1,-1}, {1,0}, {1,1} };
+        auto bit = [](int r, int c) { return (r >= 0 && r < 8 && c >= 0 && c < 8) ? 1ull << (r * 8 + c) : 0; };
+        for (int sq = 0; sq < 64; sq++) {
+            int r = sq / 8, c = sq % 8;
+            knight[sq] = king[sq] = 0;
+            for (int i = 0; i < 8; i++) {
+                knight[sq] |= bit(r + knightMoves[i][0], c + knightMoves[i][1]);
+                king[sq] |= bit(r + kingMoves[i][0], c + kingMoves[i][1]);
+            }
+            pawn[0][sq] = bit(r - 1, c - 1) | bit(r - 1, c + 1);
+            pawn[1][sq] = bit(r + 1, c - 1) | bit(r + 1, c + 1);
+        }
+    }
+};
+
+const LeaperTables leaperTables;
+
+// Piece-type and color bitboards with a square-indexed mailbox beside them for captures and lookups
+class BitboardBoard {
+public:
+    static constexpr const char* name = "bitboards";
+
+    void load(const ChessBoard& source) {
+        pieces = {};
+        colors = {};
+        for (int sq = 0; sq < 64; sq++) {
+            uint8_t p = source.pieceAt(sq / 8, sq % 8);
+            squares[sq] = p;
+            if (p == Piece::None) continue;
+            pieces[p & typeMask] |= 1ull << sq;
+            colors[sideIndex(p & colorMask)] |= 1ull << sq;
+        }
+    }
+
+    uint8_t pieceAt(int sq) const { return squares[sq]; }
+
+    void generateMoves(uint8_t color, std::vector<Move>& moves) {
+        int us = sideIndex(color);
+        uint64_t own = colors[us];
+        uint64_t occupied = colors[0] | colors[1];
+        for (uint64_t bits = own; bits;) {
+            int from = popLowest(bits);
+            uint64_t targets = 0;
+            switch (squares[from] & typeMask) {
+            case Piece::Pawn: {
+                int forward = (us == 0) ? -8 : 8;
+                int to = from + forward;
+                if (to < 0 || to >= 64) break;
+                targets = leaperTables.pawn[us][from] & colors[us ^ 1];
+                if (!(occupied & (1ull << to))) {
+                    targets |= 1ull << to;
+                    int startRow = (us == 0) ? 6 : 1;
+                    if (from / 8 == startRow && !(occupied & (1ull << (to + forward)))) targets |= 1ull << (to + forward);
+                }
+                break;
+            }
+            case Piece::Knight: targets = leaperTables.knight[from] & ~own; break;
+            case Piece::King: targets = leaperTables.king[from] & ~own; break;
+            case Piece::Bishop: targets = bishopAttacks(from, occupied) & ~own; break;
+            case Piece::Rook: targets = rookAttacks(from, occupied) & ~own; break;
+            default: targets = (rookAttacks(from, occupied) | bishopAttacks(from, occupied)) & ~own; break;
+            }
+            while (targets) {
+                int to = popLowest(targets);
+                uint8_t captured = squares[to];
+                movePiece(from, to, captured);
+                bool safe = !isAttacked(kingSquare(us), us ^ 1);
+                unmovePiece(from, to, captured);
+                if (safe) moves.push_back({ (uint8_t)from, (uint8_t)to, captured });
+            }
+        }
+    }
+
+    void doMove(const Move& m) { movePiece(m.from, m.to, m.captured); }
+    void undoMove(const Move& m) { unmovePiece(m.from, m.to, m.captured); }
+
+    bool isInCheck(uint8_t color) const {
+        int us = sideIndex(color);
+        return isAttacked(kingSquare(us), us ^ 1);
+    }
+
+private:
+    std::array<uint64_t, 7> pieces; // By type, index 0 unused
+    std::array<uint64_t, 2> colors;
+    std::array<uint8_t, 64> squares;
+
+    int kingSquare(int side) const {
+        uint64_t king = pieces[Piece::King] & colors[side];
+        return king ? popLowest(king) : -1;
+    }
+
+    void movePiece(int from, int to, uint8_t captured) {
+        uint8_t piece = squares[from];
+        if (captured != Piece::None) {
+            pieces[captured & typeMask] ^= 1ull << to;
+            colors[sideIndex(captured & colorMask)] ^= 1ull << to;
+        }
+        uint64_t fromTo = (1ull << from) | (1ull << to);
+        pieces[piece & typeMask] ^= fromTo;
+        colors[sideIndex(piece & colorMask)] ^= fromTo;
+        squares[to] = piece;
+        squares[from] = Piece::None;
+    }
+
+    void unmovePiece(int from, int to, uint8_t captured) {
+        uint8_t piece = squares[to];
+        uint64_t fromTo = (1ull << from) | (1ull << to);
+        pieces[piece & typeMask] ^= fromTo;
+        colors[sideIndex(piece & colorMask)] ^= fromTo;
+        if (captured != Piece::None) {
+            pieces[captured & typeMask] ^= 1ull << to;
+            colors[sideIndex(captured & colorMask)] ^= 1ull << to;
+        }
+        squares[from] = piece;
+        squares[to] = captured;
+    }
+
+    bool isAttacked(int sq, int bySide) const {
+        if (sq < 0) return false;
+        uint64_t by = colors[bySide];
+        uint64_t occupied = colors[0] | colors[1];
+        uint64_t queens = pieces[Piece::Queen];
+        return (leaperTables.pawn[bySide ^ 1][sq] & pieces[Piece::Pawn] & by)
+            || (leaperTables.knight[sq] & pieces[Piece::Knight] & by)
+            || (leaperTables.king[sq] & pieces[Piece::King] & by)
+            || (bishopAttacks(sq, occupied) & (pieces[Piece::Bishop] | queens) & by)
+            || (rookAttacks(sq, occupied) & (pieces[Piece::Rook] | queens) & by);
+    }
+};
+
+// A whole position in one cache line: 4 bits per square, occupancy and Black bitboards, the
+// Zobrist key and both King squares. Copying it is one 64-byte move, so copy-make costs about what
+// make/unmake does and a thread can take its own copy of a position for free.
+class alignas(64) PackedPosition {
+public:
+    static constexpr const char* name = "packed 64B";
+
+    void load(const ChessBoard& source) {
+        cells.fill(0);
+        occupied = black = 0;
+        kingSquare = { NoSquare, NoSquare };
+        for (int sq = 0; sq < 64; sq++) {
+            uint8_t p = source.pieceAt(sq / 8, sq % 8);
+            if (p == Piece::None) continue;
+            put(sq, p);
+            occupied |= 1ull << sq;
+            if (p & Piece::Black) black |= 1ull << sq;
+            if ((p & typeMask) == Piece::King) kingSquare[sideIndex(p & colorMask)] = (uint8_t)sq;
+        }
+        hash = source.hashKey();
+    }
+
+    // Nibble layout: type in the low three bits, bit 3 set for Black, zero for an empty square
+    uint8_t pieceAt(int sq) const {
+        uint8_t n = (cells[sq >> 1] >> ((sq & 1) * 4)) & 15;
+        if (n == 0) return Piece::None;
+        return (n & typeMask) | ((n & 8) ? Piece::Black : Piece::White);
+    }
+
+    void generateMoves(uint8_t color, std::vector<Move>& moves) const {
+        int us = sideIndex(color);
+        uint64_t own = us ? black : occupied & ~black;
+        uint64_t enemy = occupied & ~own;
+        for (uint64_t bits = own; bits;) {
+            int from = popLowest(bits);
+            uint64_t targets = 0;
+            switch (pieceAt(from) & typeMask) {
+            case Piece::Pawn: {
+                int forward = (us == 0) ? -8 : 8;
+                int to = from + forward;
+                if (to < 0 || to >= 64) break;
+                targets = leaperTables.pawn[us][from] & enemy;
+                if (!(occupied & (1ull << to))) {
+                    targets |= 1ull << to;
+                    int startRow = (us == 0) ? 6 : 1;
+                    if (from / 8 == startRow && !(occupied & (1ull << (to + forward)))) targets |= 1ull << (to + forward);
+                }
+                break;
+            }
+            case Piece::Knight: targets = leaperTables.knight[from] & ~own; break;
+            case Piece::King: targets = leaperTables.king[from] & ~own; break;
+            case Piece::Bishop: targets = bishopAttacks(from, occupied) & ~own; break;
+            case Piece::Rook: targets = rookAttacks(from, occupied) & ~own; break;
+            default: targets = (rookAttacks(from, occupied) | bishopAttacks(from, occupied)) & ~own; break;
+            }
+            while (targets) {
+                int to = popLowest(targets);
+                Move m{ (uint8_t)from, (uint8_t)to, pieceAt(to) };
+                PackedPosition child = *this;
+                child.doMove(m);
+                if (!child.isInCheck(color)) moves.push_back(m);
+            }
+        }
+    }
+
+    void doMove(const Move& m) {
+        uint8_t piece = pieceAt(m.from);
+        hash ^= zobrist.piece(piece, m.from) ^ zobrist.piece(piece, m.to);
+        if (m.captured != Piece::None) hash ^= zobrist.piece(m.captured, m.to);
+        put(m.to, piece);
+        put(m.from, Piece::None);
+        occupied = (occupied & ~(1ull << m.from)) | (1ull << m.to);
+        black &= ~((1ull << m.from) | (1ull << m.to));
+        if (piece & Piece::Black) black |= 1ull << m.to;
+        if ((piece & typeMask) == Piece::King) kingSquare[sideIndex(piece & colorMask)] = m.to;
+    }
+
+    void undoMove(const Move& m) {
+        uint8_t piece = pieceAt(m.to);
+        hash ^= zobrist.piece(piece, m.from) ^ zobrist.piece(piece, m.to);
+        if (m.captured != Piece::None) hash ^= zobrist.piece(m.captured, m.to);
+        put(m.from, piece);
+        put(m.to, m.captured);
+        occupied |= 1ull << m.from;
+        if (m.captured == Piece::None) occupied &= ~(1ull << m.to);
+        black &= ~((1ull << m.from) | (1ull << m.to));
+        if (piece & Piece::Black) black |= 1ull << m.from;
+        if (m.captured & Piece::Black) black |= 1ull << m.to;
+        if ((piece & typeMask) == Piece::King) kingSquare[sideIndex(piece & colorMask)] = m.from;
+    }
+
+    bool isInCheck(uint8_t color) const {
+        int us = sideIndex(color);
+        return kingSquare[us] != NoSquare && isAttacked(kingSquare[us], us ^ 1);
+    }
+
+    uint64_t hashKey() const { return hash; }
+
+private:
+    static constexpr uint8_t NoSquare = 64;
+
+    std::array<uint8_t, 32> cells;
+    uint64_t occupied;
+    uint64_t black;
+    uint64_t hash;
+    std::array<uint8_t, 2> kingSquare;
+
+    void put(int sq, uint8_t p) {
+        uint8_t n = (p == Piece::None) ? 0 : (p & typeMask) | ((p & Piece::Black) ? 8 : 0);
+        int shift = (sq & 1) * 4;
+        cells[sq >> 1] = (uint8_t)((cells[sq >> 1] & ~(15 << shift)) | (n << shift));
+    }
+
+    // No type bitboards here, so each candidate attacker is checked through its nibble
+    bool hasType(uint64_t candidates, uint8_t typeA, uint8_t typeB) const {
+        while (candidates) {
+            uint8_t type = pieceAt(popLowest(candidates)) & typeMask;
+            if (type == typeA || type == typeB) return true;
+        }
+        return false;
+    }
+
+    bool isAttacked(int sq, int bySide) const {
+        uint64_t by = bySide ? black : occupied & ~black;
+        return hasType(leaperTables.pawn[bySide ^ 1][sq] & by, Piece::Pawn, Piece::Pawn)
+            || hasType(leaperTables.knight[sq] & by, Piece::Knight, Piece::Knight)
+            || hasType(leaperTables.king[sq] & by, Piece::King, Piece::King)
+            || hasType(bishopAttacks(sq, occupied) & by, Piece::Bishop, Piece::Queen)
+            || hasType(rookAttacks(sq, occupied) & by, Piece::Rook, Piece::Queen);
+    }
+};
+
+static_assert(sizeof(PackedPosition) == 64, "PackedPosition must fill exactly one cache line");
+
+// Perft and a plain material alpha-beta over any backend. Moves are ordered by MVV-LVA with the
+// squares as tie-break, so every backend searches the identical tree and node counts must agree.
+// With CopyMake each ply works on its own copy of the position instead of undoing the move.
+template <class Board, bool CopyMake = false>
+class BackendSearch {
+public:
+    void setRoot(const Board& root) { positions[0] = root; }
+
+    uint64_t perft(uint8_t color, int depth, int ply = 0) {
+        std::vector<Move>& moves = moveStack[ply];
+        moves.clear();
+        at(ply).generateMoves(color, moves);
+        if (depth <= 1) return (depth == 1) ? moves.size() : 1;
+        uint64_t count = 0;
+        for (const Move& m : moves) {
+            make(m, ply);
+            count += perft(opposite(color), depth - 1, ply + 1);
+            unmake(m, ply);
+        }
+        return count;
+    }
+
+    int search(uint8_t color, int depth) {
+        return alphaBeta(color, depth, -InfiniteScore, InfiniteScore, 0, rootMaterial(color));
+    }
+
+    // Score of one root move with a full window, independent of the other root moves
+    int searchRootMove(uint8_t color, const Move& m, int depth) {
+        int material = rootMaterial(color);
+        make(m, 0);
+        int score = -alphaBeta(opposite(color), depth - 1, -InfiniteScore, InfiniteScore, 1, -(material + pieceValues[m.captured & typeMask]));
+        unmake(m, 0);
+        return score;
+    }
+
+    uint64_t perftRootMove(uint8_t color, const Move& m, int depth) {
+        make(m, 0);
+        uint64_t count = perft(opposite(color), depth - 1, 1);
+        unmake(m, 0);
+        return count;
+    }
+
+    uint64_t nodes = 0;
+
+private:
+    // Only [0] is used by make/unmake
+    std::array<Board, CopyMake ? MaxPly + 2 : 1> positions;
+    std::array<std::vector<Move>, MaxPly + 1> moveStack;
+    std::array<std::vector<int>, MaxPly + 1> scoreStack;
+
+    Board& at(int ply) { return positions[CopyMake ? ply : 0]; }
+
+    void make(const Move& m, int ply) {
+        if constexpr (CopyMake) {
+            positions[ply + 1] = positions[ply];
+            positions[ply + 1].doMove(m);
+        } else {
+            positions[0].doMove(m);
+        }
+    }
+
+    void unmake(const Move& m, int ply) {
+        (void)ply;
+        if constexpr (!CopyMake) positions[0].undoMove(m);
+    }
+
+    int rootMaterial(uint8_t color) {
+        int material = 0;
+        for (int sq = 0; sq < 64; sq++) {
+            uint8_t p = positions[0].pieceAt(sq);
+            if (p != Piece::None) material += ((p & colorMask) == color) ? pieceValues[p & typeMask] : -pieceValues[p & typeMask];
+        }
+        return material;
+    }
+
+    // 'material' is from the side to move's view, a capture gains the victim's value
+    int alphaBeta(uint8_t color, int depth, int alpha, int beta, int ply, int material) {
+        nodes++;
+        if (depth <= 0 || ply >= MaxPly) return quiesce(color, alpha, beta, ply, material);
+        std::vector<Move>& moves = orderedMoves(color, ply);
+        if (moves.empty()) return at(ply).isInCheck(color) ? -MateScore + ply : 0;
+        for (size_t i = 0; i < moves.size(); i++) {
+            const Move& m = pick(ply, i);
+            make(m, ply);
+            int score = -alphaBeta(opposite(color), depth - 1, -beta, -alpha, ply + 1, -(material + pieceValues[m.captured & typeMask]));
+            unmake(m, ply);
+            if (score >= beta) return score;
+            alpha = std::max(alpha, score);
+        }
+        return alpha;
+    }
+
+    int quiesce(uint8_t color, int alpha, int beta, int ply, int material) {
+        if (material >= beta || ply >= MaxPly) return material;
+        alpha = std::max(alpha, material);
+        std::vector<Move>& moves = orderedMoves(color, ply);
+        for (size_t i = 0; i < moves.size(); i++) {
+            const Move& m = pick(ply, i);
+            if (m.captured == Piece::None) break; // Captures sort first
+            nodes++;
+            make(m, ply);
+            int score = -quiesce(opposite(color), -beta, -alpha, ply + 1, -(material + pieceValues[m.captured & typeMask]));
+            unmake(m, ply);
+            if (score >= beta) return score;
+            alpha = std::max(alpha, score);
+        }
+        return alpha;
+    }
+
+    std::vector<Move>& orderedMoves(uint8_t color, int ply) {
+        std::vector<Move>& moves = moveStack[ply];
+        std::vector<int>& scores = scoreStack[ply];
+        moves.clear();
+        scores.clear();
+        at(ply).generateMoves(color, moves);
+        for (const Move& m : moves) {
+            int attacker = at(ply).pieceAt(m.from) & typeMask;
+            int mvvLva = (m.captured != Piece::None) ? 64 + (m.captured & typeMask) * 8 - attacker : 0;
+            scores.push_back(mvvLva * 4096 + 4095 - (m.from * 64 + m.to));
+        }
+        return moves;
+    }
+
+    const Move& pick(int ply, size_t i) {
+        std::vector<Move>& moves = moveStack[ply];
+        std::vector<int>& scores = scoreStack[ply];
+        size_t best = i;
+        for (size_t j = i + 1; j < moves.size(); j++)
+            if (scores[j] > scores[best]) best = j;
+        std::swap(moves[i], moves[best]);
+        std::swap(scores[i], scores[best]);
+        return moves[i];
+    }
+};
+
+struct BackendResult {
+    uint64_t perftNodes = 0, searchNodes = 0;
+    int64_t perftMs = 0, searchMs = 0;
+};
+
+// Root moves are dealt round-robin to 'threads' workers, each starting from its own copy of the
+// root, which is the copy a thread-parallel search pays for before it can begin
+template <class Board, bool CopyMake>
+BackendResult benchBackend(const std::vector<std::string>& fens, int perftDepth, int searchDepth, int threads) {
+    BackendResult result;
+    for (const std::string& fen : fens) {
+        ChessBoard source;
+        bool isWhitesTurn = true;
+        source.loadFen(fen, isWhitesTurn);
+        uint8_t color = isWhitesTurn ? Piece::White : Piece::Black;
+        Board root;
+        root.load(source);
+        std::vector<Move> rootMoves;
+        Board(root).generateMoves(color, rootMoves);
+
+        std::vector<uint64_t> counts(threads);
+        auto runSplit = [&](bool perft) {
+            std::fill(counts.begin(), counts.end(), 0);
+            auto start = std::chrono::steady_clock::now();
+            std::vector<std::thread> workers;
+            for (int t = 0; t < threads; t++) {
+                workers.emplace_back([&, t]() {
+                    auto search = std::make_unique<BackendSearch<Board, CopyMake>>();
+                    search->setRoot(root);
+                    for (size_t i = t; i < rootMoves.size(); i += threads) {
+                        if (perft) counts[t] += search->perftRootMove(color, rootMoves[i], perftDepth);
+                        else search->searchRootMove(color, rootMoves[i], searchDepth);
+                    }
+                    if (!perft) counts[t] = search->nodes;
+                });
+            }
+            for (std::thread& worker : workers) worker.join();
+            return (int64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+        };
+        result.perftMs += runSplit(true);
+        for (uint64_t c : counts) result.perftNodes += c;
+        result.searchMs += runSplit(false);
+        for (uint64_t c : counts) result.searchNodes += c;
+    }
+    return result;
+}
+
+// Usage: chess boards [perftDepth] [searchDepth] [fen] [--threads N]
+// Runs the same perft and search over every backend with make/unmake and with copy-make,
+// on the bench positions unless a FEN is given
+int runBoards(int argc, char* argv[]) {
+    int perftDepth = 4;
+    int searchDepth = 4;
+    int threads = 1;
+    int numbers = 0;
+    std::string fen;
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) threads = std::max(1, std::atoi(argv[++i]));
+        else if (numbers == 0 && std::isdigit((unsigned char)arg[0])) { perftDepth = std::max(1, std::atoi(argv[i])); numbers++; }
+        else if (numbers == 1 && std::isdigit((unsigned char)arg[0])) { searchDepth = std::max(1, std::atoi(argv[i])); numbers++; }
+        else fen += (fen.empty() ? "" : " ") + arg;
+    }
+    std::vector<std::string> fens;
+    if (!fen.empty()) {
+        ChessBoard check;
+        bool isWhitesTurn = true;
+        if (!check.loadFen(fen, isWhitesTurn)) {
+            cout << "Invalid FEN: " << fen << newline;
+            return 1;
+        }
+        fens.push_back(fen);
+    } else {
+        fens.assign(std::begin(benchPositions), std::end(benchPositions));
+    }
+
+    struct Row { const char* name; const char* strategy; size_t size; BackendResult result; };
+    std::vector<Row> rows = {
+        { ArrayBoard::name, "make/unmake", sizeof(ArrayBoard), benchBackend<ArrayBoard, false>(fens, perftDepth, searchDepth, threads) },
+        { ArrayBoard::name, "copy-make", sizeof(ArrayBoard), benchBackend<ArrayBoard, true>(fens, perftDepth, searchDepth, threads) },
+        { Mailbox0x88::name, "make/unmake", sizeof(Mailbox0x88), benchBackend<Mailbox0x88, false>(fens, perftDepth, searchDepth, threads) },
+        { Mailbox0x88::name, "copy-make", sizeof(Mailbox0x88), benchBackend<Mailbox0x88, true>(fens, perftDepth, searchDepth, threads) },
+        { BitboardBoard::name, "make/unmake", sizeof(BitboardBoard), benchBackend<BitboardBoard, false>(fens, perftDepth, searchDepth, threads) },
+        { BitboardBoard::name, "copy-make", sizeof(BitboardBoard), benchBackend<BitboardBoard, true>(fens, perftDepth, searchDepth, threads) },
+        { PackedPosition::name, "make/unmake", sizeof(PackedPosition), benchBackend<PackedPosition, false>(fens, perftDepth, searchDepth, threads) },
+        { PackedPosition::name, "copy-make", sizeof(PackedPosition), benchBackend<PackedPosition, true>(fens, perftDepth, searchDepth, threads) },
+    };
+
+    auto column = [](const std::string& s, int width) {
+        return std::string(std::max(0, width - (int)s.size()), ' ') + s;
+    };
+    auto left = [](std::string s, int width) { s.resize(width, ' '); return s; };
+    cout << threads << " thread" << (threads > 1 ? "s" : "") << newline;
+    cout << left("Backend", 14) << left("Strategy", 12) << column("Bytes", 6) << column("Perft(" + std::to_string(perftDepth) + ")", 12)
+        << column("NPS", 11) << column("Search(" + std::to_string(searchDepth) + ")", 13) << column("NPS", 11) << newline;
+    for (const Row& row : rows) {
+        const BackendResult& r = row.result;
+        cout << left(row.name, 14) << left(row.strategy, 12) << column(std::to_string(row.size), 6)
+            << column(std::to_string(r.perftNodes), 12) << column(std::to_string(r.perftNodes * 1000 / (r.perftMs + 1)), 11)
+            << column(std::to_string(r.searchNodes), 13) << column(std::to_string(r.searchNodes * 1000 / (r.searchMs + 1)), 11) << newline;
+    }
+    for (const Row& row : rows) {
+        if (row.result.perftNodes != rows[0].result.perftNodes || row.result.searchNodes != rows[0].result.searchNodes) {
+            cout << "Node counts differ between backends" << newline;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    // '--trace' records events for any mode and writes trace.json at exit (or on a crash).
+    // '--hash <MB>' sizes the transposition table, '--param name=value' sets a search parameter,
+    // '--nnue <file>' evaluates with a network from 'train', '--book <file>' shows book moves in the game.
+    // These are removed so the modes below never see them.
+    std::vector<char*> args;
+    size_t hashMB = defaultHashMB;
+    for (int i = 0; i < argc; i++) {
+        if (std::string(argv[i]) == "--trace") {
+            enableTracing();
+            std::atexit([]() { dumpTrace(traceFile); });
+            continue;
+        }
+        if (std::string(argv[i]) == "--hash" && i + 1 < argc) {
+            hashMB = std::max(1, std::atoi(argv[++i]));
+            continue;
+        }
+        if (std::string(argv[i]) == "--nnue" && i + 1 < argc) {
+            if (!nnue.load(argv[++i])) cout << "Could not load network: " << argv[i] << newline;
+            continue;
+        }
+        if (std::string(argv[i]) == "--book" && i + 1 < argc) {
+            if (openingBook.load(argv[++i])) showBookMoves = printBookMoves;
+            else cout << "Could not load opening book: " << argv[i] << newline;
+            continue;
+        }
+        if (std::string(argv[i]) == "--param" && i + 1 < argc) {
+            if (!setSearchParam(searchParams, argv[++i])) cout << "Unknown search parameter: " << argv[i] << newline;
+            continue;
+        }
+        args.push_back(argv[i]);
+    }
+    argc = (int)args.size();
+    argv = args.data();
+
+    // Only these modes search with the shared table, the others bring their own tables or never probe one
+    // (mcts scores its leaves with quiescence or the network, neither of which touches the TT).
+    // The memory report is left to the interactive game so that mode output stays machine-readable.
+    static const char* sharedTableModes[] = { "bench", "multipv", "analyze" };
+    for (const char* mode : sharedTableModes)
+        if (argc > 1 && std::string(argv[1]) == mode) transpositionTable.resize(hashMB);
+
+    if (argc > 1 && std::string(argv[1]) == "perft") return runPerft(argc, argv);
+    if (argc > 1 && std::string(argv[1]) == "bench") return runBench(argc, argv);
+    if (argc > 1 && std::string(argv[1]) == "multipv") return runMultiPV(argc, argv);
+    if (argc > 1 && std::string(argv[1]) == "selfplay") return runSelfPlay(argc, argv);
+    if (argc > 1 && std::string(argv[1]) == "mate") return runMate(argc, argv);
+    if (argc > 1 && std::string(argv[1]) == "mcts") return runMcts(argc, argv);
+    if (argc > 1 && std::string(argv[1]) == "analyze") return runAnalyze(argc, argv);
+    if (argc > 1 && std::string(argv[1]) == "datagen") return runDatagen(argc, argv);
+    if (argc > 1 && std::string(argv[1]) == "shuffle") return runShuffle(argc, argv);
+    if (argc > 1 && std::string(argv[1]) == "train") return runTrain(argc, argv);
+    if (argc > 1 && std::string(argv[1]) == "puzzles") return runPuzzles(argc, argv);
+    if (argc > 1 && std::string(argv[1]) == "annotate") return runAnnotate(argc, argv);
+    if (argc > 1 && std::string(argv[1]) == "book") return runBookBuild(argc, argv);
+    if (argc > 1 && std::string(argv[1]) == "boards") return runBoards(argc, argv);
+
     ChessBoard game;
     bool isRunning = true;
     bool isWhitesTurn = true;
     cout << "\033[2J";
     game.render();
+#if DEBUG_MODE
+    memoryRegistry.report(); // Startup footprint, 'mem' at the prompt prints it again and the exit prints it last
+#endif
     while (isRunning) {
         game.makeMove(isWhitesTurn, isRunning);
         isWhitesTurn = !isWhitesTurn;
     }
+    inputLatency.report();
+#if DEBUG_MODE
+    memoryRegistry.report(); // Shutdown footprint, to compare with the one at startup
+#endif
     return 0;
 }
\ No newline at end of file